@@ -0,0 +1,772 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpioclient.h"
+#include "gpiolib.h"
+
+#define MAX_CHIPS 16
+#define MAX_CLIENTS 64
+#define MAX_THREADS 64
+
+typedef struct
+{
+    const char *name;
+    int writes;         /* Changes the GPIO state */
+    unsigned (*run)(unsigned iter);   /* Returns the number of operations */
+} BENCH_T;
+
+typedef struct
+{
+    pthread_t thread;
+    unsigned index;
+    uint64_t deadline;
+    uint64_t updates;
+    uint64_t lost;
+} STRESS_T;
+
+static unsigned num_gpios;
+static unsigned valid_gpios[MAX_GPIO_PINS];
+static unsigned num_valid_gpios;
+static GPIO_PIN_STATE_T states[MAX_GPIO_PINS];
+static volatile unsigned sink;
+static unsigned stress_threads;
+static GPIO_FSEL_T stress_fsels[MAX_GPIO_PINS];    /* GPIO_FSEL_MAX if unreadable */
+static GPIO_PULL_T stress_pulls[MAX_GPIO_PINS];
+static GPIO_DRIVE_T stress_drives[MAX_GPIO_PINS];
+static GPIO_CLIENT_T *client;
+static GPIO_PIN_STATE_T client_states[64];
+
+/* Three different chips, at bases 0, 100 and 200, fill as much of the GPIO
+ * number space as the rounding of the bases allows.
+ */
+static const struct
+{
+    const char *node;
+    const char *compatible;
+    uint32_t reg[2];
+    unsigned num_names;
+    char prefix;
+} multi_chips[] =
+{
+    { "/soc/gpio@7e200000", "brcm,bcm2835-gpio", { 0x7e200000, 0xb4 }, 54, 'A' },
+    { "/soc/gpio@7e300000", "brcm,bcm2711-gpio", { 0x7e300000, 0xf4 }, 58, 'B' },
+    { "/rp1/gpio@d0000", "raspberrypi,rp1-gpio", { 0xc00d0000, 0xc000 }, 54, 'C' },
+};
+
+static uint64_t time_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned bench_get_level(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+        sink += gpio_get_level(valid_gpios[i]);
+    (void)iter;
+    return num_valid_gpios;
+}
+
+static unsigned bench_get_fsel(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+        sink += gpio_get_fsel(valid_gpios[i]);
+    (void)iter;
+    return num_valid_gpios;
+}
+
+static unsigned bench_set_drive(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+        gpio_set_drive(valid_gpios[i], (iter & 1) ? DRIVE_HIGH : DRIVE_LOW);
+    return num_valid_gpios;
+}
+
+static unsigned bench_set_fsel(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+        gpio_set_fsel(valid_gpios[i], (iter & 1) ? GPIO_FSEL_OUTPUT : GPIO_FSEL_INPUT);
+    return num_valid_gpios;
+}
+
+static unsigned bench_set_pull(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+        gpio_set_pull(valid_gpios[i], (iter & 1) ? PULL_UP : PULL_DOWN);
+    return num_valid_gpios;
+}
+
+static unsigned bench_name_lookup(unsigned iter)
+{
+    unsigned i;
+
+    for (i = 0; i < num_valid_gpios; i++)
+    {
+        const char *name = gpio_get_name(valid_gpios[i]);
+
+        sink += gpio_get_gpio_by_name(name, strlen(name));
+    }
+    (void)iter;
+    return num_valid_gpios;
+}
+
+static unsigned bench_get_dump(unsigned iter)
+{
+    char line[256];
+    unsigned i;
+
+    // What "pinctrl get" does, minus the printing
+    gpio_snapshot(0, num_gpios, states);
+    for (i = 0; i < num_valid_gpios; i++)
+    {
+        unsigned gpio = valid_gpios[i];
+        GPIO_PIN_STATE_T *state = &states[gpio];
+
+        sink += snprintf(line, sizeof(line), "%2d: %2s %s %s | %s // %s = %s\n",
+                         gpio, gpio_get_fsel_name(state->fsel),
+                         gpio_get_drive_name(state->drive),
+                         gpio_get_pull_name(state->pull),
+                         (state->level == 1) ? "hi" : "lo",
+                         gpio_get_name(gpio),
+                         gpio_get_gpio_fsel_name(gpio, state->fsel));
+    }
+    (void)iter;
+    return 1;
+}
+
+static const BENCH_T benches[] =
+{
+    { "get_level", 0, bench_get_level },
+    { "get_fsel", 0, bench_get_fsel },
+    { "set_drive", 1, bench_set_drive },
+    { "set_fsel", 1, bench_set_fsel },
+    { "set_pull", 1, bench_set_pull },
+    { "name lookup", 0, bench_name_lookup },
+    { "get dump", 0, bench_get_dump },
+};
+
+static unsigned client_get_levels(unsigned iter)
+{
+    uint32_t levels;
+
+    (void)iter;
+    if (gpio_client_get_levels(client, 0, ~0u, &levels) != 0)
+        return 0;
+    sink += levels;
+    return 1;
+}
+
+static unsigned client_snapshot_1(unsigned iter)
+{
+    (void)iter;
+    return gpio_client_snapshot(client, 0, 1, client_states) == 0;
+}
+
+static unsigned client_snapshot_64(unsigned iter)
+{
+    (void)iter;
+    return gpio_client_snapshot(client, 0, 64, client_states) == 0;
+}
+
+static unsigned client_set_drive(unsigned iter)
+{
+    return gpio_client_set_drive(client, 0, (iter & 1) ? DRIVE_HIGH : DRIVE_LOW) == 0;
+}
+
+static unsigned client_toggle_mask(unsigned iter)
+{
+    (void)iter;
+    return gpio_client_toggle_mask(client, 0, 1) == 0;
+}
+
+static const BENCH_T client_benches[] =
+{
+    { "get_levels", 0, client_get_levels },
+    { "snapshot 1", 0, client_snapshot_1 },
+    { "snapshot 64", 0, client_snapshot_64 },
+    { "set_drive", 1, client_set_drive },
+    { "toggle_mask", 1, client_toggle_mask },
+};
+
+static int run_benches(const char *label, uint64_t min_ns, int writes)
+{
+    unsigned gpio, i;
+
+    num_valid_gpios = 0;
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        if (gpio_num_is_valid(gpio))
+            valid_gpios[num_valid_gpios++] = gpio;
+    }
+    if (!num_valid_gpios)
+        return 1;
+
+    printf("%s (%u GPIOs):\n", label, num_valid_gpios);
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        const BENCH_T *bench = &benches[i];
+        uint64_t ops = 0, t0, elapsed;
+        unsigned iter = 0, n = 1, j;
+
+        if (bench->writes && !writes)
+        {
+            printf("  %-12s skipped (use -w to write to the hardware)\n", bench->name);
+            continue;
+        }
+
+        // Double the batch size until it takes long enough to time
+        t0 = time_now_ns();
+        do
+        {
+            for (j = 0; j < n; j++)
+                ops += bench->run(iter++);
+            n *= 2;
+            elapsed = time_now_ns() - t0;
+        } while (elapsed < min_ns);
+
+        printf("  %-12s %10.1f ns/op\n", bench->name, (double)elapsed / ops);
+    }
+
+    return 0;
+}
+
+static int write_prop(const char *dir, const char *node, const char *prop,
+                      const void *data, size_t len)
+{
+    char path[FILENAME_MAX];
+    char *p;
+    FILE *fp;
+    int ok;
+
+    if (snprintf(path, sizeof(path), "%s%s/%s", dir, node, prop) >= (int)sizeof(path))
+        return -1;
+    for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    ok = fwrite(data, 1, len, fp) == len;
+    return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+static int write_cells(const char *dir, const char *node, const char *prop,
+                       const uint32_t *cells, unsigned num_cells)
+{
+    uint8_t buf[16];
+    unsigned i;
+
+    // Device Tree cells are big-endian
+    for (i = 0; i < num_cells; i++)
+    {
+        buf[i * 4 + 0] = cells[i] >> 24;
+        buf[i * 4 + 1] = cells[i] >> 16;
+        buf[i * 4 + 2] = cells[i] >> 8;
+        buf[i * 4 + 3] = cells[i];
+    }
+    return write_prop(dir, node, prop, buf, num_cells * 4);
+}
+
+static int write_multi_dt(const char *dir)
+{
+    static const uint32_t soc_ranges[] = { 0x7e000000, 0, 0xfe000000, 0x1800000 };
+    static const uint32_t rp1_ranges[] = { 0xc0000000, 0x1f, 0x00000000, 0x400000 };
+    static const uint32_t two = 2, one = 1;
+    char names[58 * 8];
+    unsigned i, j;
+    int ret = 0;
+
+    ret |= write_cells(dir, "", "#address-cells", &two, 1);
+    ret |= write_cells(dir, "", "#size-cells", &one, 1);
+    ret |= write_prop(dir, "/soc", "compatible", "simple-bus", 11);
+    ret |= write_cells(dir, "/soc", "#address-cells", &one, 1);
+    ret |= write_cells(dir, "/soc", "#size-cells", &one, 1);
+    ret |= write_cells(dir, "/soc", "ranges", soc_ranges, 4);
+    ret |= write_prop(dir, "/rp1", "compatible", "simple-bus", 11);
+    ret |= write_cells(dir, "/rp1", "#address-cells", &one, 1);
+    ret |= write_cells(dir, "/rp1", "#size-cells", &one, 1);
+    ret |= write_cells(dir, "/rp1", "ranges", rp1_ranges, 4);
+
+    for (i = 0; i < sizeof(multi_chips) / sizeof(multi_chips[0]); i++)
+    {
+        const char *node = multi_chips[i].node;
+        char alias[8];
+        size_t len = 0;
+
+        snprintf(alias, sizeof(alias), "gpio%u", i);
+        ret |= write_prop(dir, "/aliases", alias, node, strlen(node) + 1);
+        ret |= write_prop(dir, node, "compatible", multi_chips[i].compatible,
+                          strlen(multi_chips[i].compatible) + 1);
+        ret |= write_cells(dir, node, "reg", multi_chips[i].reg, 2);
+        ret |= write_prop(dir, node, "gpio-controller", "", 0);
+        for (j = 0; j < multi_chips[i].num_names; j++)
+            len += sprintf(names + len, "%c%u", multi_chips[i].prefix, j) + 1;
+        ret |= write_prop(dir, node, "gpio-line-names", names, len);
+    }
+
+    return ret;
+}
+
+/* Count the settings of a GPIO that aren't what its thread last wrote -
+ * updates lost to a read-modify-write by another thread - and resync.
+ */
+static unsigned stress_check(unsigned gpio)
+{
+    GPIO_FSEL_T fsel = gpio_get_fsel(gpio);
+    GPIO_PULL_T pull = gpio_get_pull(gpio);
+    GPIO_DRIVE_T drive = gpio_get_drive(gpio);
+    unsigned lost = 0;
+
+    if (stress_fsels[gpio] != GPIO_FSEL_MAX)
+    {
+        lost += (fsel != stress_fsels[gpio]);
+        stress_fsels[gpio] = fsel;
+    }
+    if (stress_pulls[gpio] != PULL_MAX)
+    {
+        lost += (pull != stress_pulls[gpio]);
+        stress_pulls[gpio] = pull;
+    }
+    if (stress_drives[gpio] != DRIVE_MAX)
+    {
+        lost += (drive != stress_drives[gpio]);
+        stress_drives[gpio] = drive;
+    }
+    return lost;
+}
+
+/* Each thread owns every stress_threads'th GPIO, so neighbouring GPIOs -
+ * which share registers - belong to different threads.
+ */
+static void *stress_thread(void *arg)
+{
+    static const GPIO_FSEL_T fsels[] = { GPIO_FSEL_FUNC1, GPIO_FSEL_FUNC2, GPIO_FSEL_FUNC3 };
+    static const GPIO_PULL_T pulls[] = { PULL_NONE, PULL_DOWN, PULL_UP };
+    STRESS_T *stress = arg;
+    uint32_t rand = 0x9e3779b9 * (stress->index + 1);
+    unsigned owned[MAX_GPIO_PINS];
+    unsigned num_owned = 0, i;
+
+    for (i = stress->index; i < num_valid_gpios; i += stress_threads)
+        owned[num_owned++] = valid_gpios[i];
+    if (!num_owned)
+        return NULL;
+
+    while (time_now_ns() < stress->deadline)
+    {
+        for (i = 0; i < 16; i++)
+        {
+            unsigned gpio;
+
+            // xorshift32
+            rand ^= rand << 13;
+            rand ^= rand >> 17;
+            rand ^= rand << 5;
+            gpio = owned[(rand >> 8) % num_owned];
+            stress->lost += stress_check(gpio);
+
+            switch (rand % 3)
+            {
+            case 0:
+                if (stress_fsels[gpio] != GPIO_FSEL_MAX)
+                    stress_fsels[gpio] = fsels[(rand >> 4) % 3];
+                gpio_set_fsel(gpio, fsels[(rand >> 4) % 3]);
+                break;
+            case 1:
+                if (stress_pulls[gpio] != PULL_MAX)
+                    stress_pulls[gpio] = pulls[(rand >> 4) % 3];
+                gpio_set_pull(gpio, pulls[(rand >> 4) % 3]);
+                break;
+            default:
+                if (stress_drives[gpio] != DRIVE_MAX)
+                    stress_drives[gpio] = (rand & 16) ? DRIVE_HIGH : DRIVE_LOW;
+                gpio_set_drive(gpio, (rand & 16) ? DRIVE_HIGH : DRIVE_LOW);
+                break;
+            }
+            stress->updates++;
+        }
+    }
+
+    for (i = 0; i < num_owned; i++)
+        stress->lost += stress_check(owned[i]);
+    return NULL;
+}
+
+static int run_stress(uint64_t min_ns)
+{
+    STRESS_T stress[MAX_THREADS];
+    int thread_safe;
+    unsigned gpio, i;
+    int ret = 0;
+
+    /* Run without the locks first, to show that the test can see lost
+     * updates, then with them.
+     */
+    for (thread_safe = 0; thread_safe <= 1; thread_safe++)
+    {
+        uint64_t updates = 0, lost = 0;
+        uint64_t deadline;
+
+        /* Start from what is in the registers, as the unlocked pass can
+         * change a GPIO after its owner last checked it.
+         */
+        for (gpio = 0; gpio < num_gpios; gpio++)
+        {
+            stress_fsels[gpio] = gpio_get_fsel(gpio);
+            stress_pulls[gpio] = gpio_get_pull(gpio);
+            stress_drives[gpio] = gpio_get_drive(gpio);
+        }
+
+        gpiolib_set_thread_safe(thread_safe);
+        deadline = time_now_ns() + min_ns;
+        for (i = 0; i < stress_threads; i++)
+        {
+            stress[i].index = i;
+            stress[i].deadline = deadline;
+            stress[i].updates = 0;
+            stress[i].lost = 0;
+            if (pthread_create(&stress[i].thread, NULL, stress_thread, &stress[i]) != 0)
+                return 1;
+        }
+        for (i = 0; i < stress_threads; i++)
+        {
+            pthread_join(stress[i].thread, NULL);
+            updates += stress[i].updates;
+            lost += stress[i].lost;
+        }
+
+        printf("  %-12s %10" PRIu64 " updates, %" PRIu64 " lost\n",
+               thread_safe ? "thread-safe" : "unlocked", updates, lost);
+        if (thread_safe && lost)
+            ret = 1;
+    }
+
+    return ret;
+}
+
+static int bench_chip(const char *chip, const char *dtb, const char *sim,
+                      uint64_t min_ns, int writes)
+{
+    int ret;
+
+    if (dtb)
+        gpiolib_set_dtb(dtb);
+    if (sim)
+        gpiolib_set_sim(sim);
+
+    ret = chip ? gpiolib_init_by_name(chip) : gpiolib_init();
+    if (ret <= 0)
+    {
+        printf("Failed to initialise gpiolib for %s\n", chip ? chip : dtb ? dtb : "this system");
+        return 1;
+    }
+    num_gpios = ret;
+
+    ret = gpiolib_mmap();
+    if (ret)
+    {
+        printf("Failed to mmap gpiolib - %s\n", (ret > 0) ? strerror(ret) : "probe failed");
+        return 1;
+    }
+
+    if (stress_threads)
+    {
+        unsigned gpio;
+
+        // Map everything before the threads start, as they would without locks
+        gpio_snapshot(0, num_gpios, states);
+        num_valid_gpios = 0;
+        for (gpio = 0; gpio < num_gpios; gpio++)
+        {
+            if (gpio_num_is_valid(gpio))
+                valid_gpios[num_valid_gpios++] = gpio;
+        }
+        printf("%s (%u GPIOs, %u threads):\n", chip ? chip : dtb, num_valid_gpios,
+               stress_threads);
+        return run_stress(min_ns);
+    }
+
+    return run_benches(chip ? chip : dtb ? dtb : "hardware", min_ns, writes || sim);
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Each client process runs every benchmark in the same time window as
+ * the others, writing its count of completed requests to the pipe.
+ */
+static int client_worker(const char *path, uint64_t start, uint64_t min_ns,
+                         int writes, int out_fd)
+{
+    unsigned i;
+
+    client = gpio_client_open(path);
+    for (i = 0; i < sizeof(client_benches) / sizeof(client_benches[0]); i++)
+    {
+        const BENCH_T *bench = &client_benches[i];
+        uint64_t window = start + i * (min_ns + min_ns / 4);
+        uint64_t ops = 0;
+        unsigned iter = 0;
+
+        if (client && (!bench->writes || writes))
+        {
+            sleep_until_ns(window);
+            while (monotonic_ns() < window + min_ns)
+            {
+                unsigned done = bench->run(iter++);
+
+                if (!done)
+                {
+                    ops = 0;
+                    break;
+                }
+                ops += done;
+            }
+        }
+        if (write(out_fd, &ops, sizeof(ops)) != sizeof(ops))
+            return 1;
+    }
+    gpio_client_close(client);
+    return 0;
+}
+
+static int bench_server(const char *path, unsigned num_clients,
+                        uint64_t min_ns, int writes)
+{
+    uint64_t totals[sizeof(client_benches) / sizeof(client_benches[0])];
+    uint64_t start;
+    unsigned i, j;
+    int fds[2];
+    int ret = 0;
+
+    if (pipe(fds) != 0)
+        return 1;
+
+    // Leave the clients time to connect before the first window
+    start = monotonic_ns() + 100000000;
+    fflush(stdout);
+    for (i = 0; i < num_clients; i++)
+    {
+        pid_t pid = fork();
+
+        if (pid < 0)
+            return 1;
+        if (pid == 0)
+        {
+            close(fds[0]);
+            exit(client_worker(path, start, min_ns, writes, fds[1]));
+        }
+    }
+    close(fds[1]);
+
+    memset(totals, 0, sizeof(totals));
+    for (i = 0; i < num_clients; i++)
+    {
+        for (j = 0; j < sizeof(client_benches) / sizeof(client_benches[0]); j++)
+        {
+            uint64_t count;
+
+            // The writes from different clients interleave, so just add them up
+            if (read(fds[0], &count, sizeof(count)) != sizeof(count))
+                ret = 1;
+            else
+                totals[j] += count;
+        }
+    }
+    close(fds[0]);
+    while (wait(NULL) > 0 || errno == EINTR)
+        continue;
+    if (ret)
+        return ret;
+
+    printf("%s (%u client%s):\n", path, num_clients, (num_clients == 1) ? "" : "s");
+    for (j = 0; j < sizeof(client_benches) / sizeof(client_benches[0]); j++)
+    {
+        const BENCH_T *bench = &client_benches[j];
+        uint64_t total = totals[j];
+
+        if (bench->writes && !writes)
+            printf("  %-12s skipped (use -w to change GPIO 0)\n", bench->name);
+        else if (!total)
+            printf("  %-12s failed\n", bench->name);
+        else
+            printf("  %-12s %10.0f req/s %10.1f us/req\n", bench->name,
+                   (double)total * 1e9 / min_ns,
+                   (double)min_ns * num_clients / total / 1000.0);
+    }
+
+    return 0;
+}
+
+static void usage(void)
+{
+    printf("Usage: gpiobench [-s <dir>] [-d <dtb> | -m | -c <chip>...] [-t <ms>] [-w]\n");
+    printf("       gpiobench -S <socket> [-n <clients>] [-t <ms>] [-w]\n");
+    printf("       gpiobench -T <threads> [-s <dir>] [-d <dtb> | -m | -c <chip>...] [-t <ms>]\n");
+    printf("Times the gpiolib operations on each GPIO of the current system or, with\n");
+    printf("-d or -c, on register images (see gpiolib_set_sim) in the -s directory\n");
+    printf("(default /dev/shm/gpiobench). -c can be repeated to compare chips. Each\n");
+    printf("operation runs for at least -t milliseconds (default 200). Operations that\n");
+    printf("change the GPIOs are only run on the hardware if -w is given.\n");
+    printf("-m simulates a system with three GPIO chips, filling the GPIO number space,\n");
+    printf("by writing a Device Tree for it to the \"dt\" subdirectory of the -s directory.\n");
+    printf("-S measures the request rate of a \"pinctrl --serve\" server with -n clients\n");
+    printf("(default 1) running at once. With -w, GPIO 0 is toggled.\n");
+    printf("-T runs a stress test on the simulated registers instead of the benchmarks:\n");
+    printf("the given number of threads change the functions, pulls and drives of\n");
+    printf("interleaved GPIOs, and the changes lost to other threads are counted, first\n");
+    printf("without and then with gpiolib_set_thread_safe. It fails if any are lost\n");
+    printf("in thread-safe mode.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *chips[MAX_CHIPS];
+    const char *dtb = NULL;
+    const char *sim = NULL;
+    const char *server = NULL;
+    char dt_dir[FILENAME_MAX];
+    uint64_t min_ns = 200000000;
+    unsigned num_chips = 0, num_clients = 1, i;
+    int writes = 0, multi = 0;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "c:d:mn:s:S:t:T:wh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (num_chips == MAX_CHIPS)
+            {
+                printf("Too many chips\n");
+                return 1;
+            }
+            chips[num_chips++] = optarg;
+            break;
+        case 'd':
+            dtb = optarg;
+            break;
+        case 'm':
+            multi = 1;
+            break;
+        case 'n':
+            num_clients = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sim = optarg;
+            break;
+        case 'S':
+            server = optarg;
+            break;
+        case 't':
+            min_ns = strtoull(optarg, NULL, 0) * 1000000;
+            break;
+        case 'T':
+            stress_threads = strtoul(optarg, NULL, 0);
+            if (stress_threads < 1 || stress_threads > MAX_THREADS)
+            {
+                usage();
+                return 1;
+            }
+            break;
+        case 'w':
+            writes = 1;
+            break;
+        default:
+            usage();
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (optind != argc || (!!num_chips + !!dtb + multi + !!server) > 1 ||
+        num_clients < 1 || num_clients > MAX_CLIENTS)
+    {
+        usage();
+        return 1;
+    }
+
+    if (server)
+        return bench_server(server, num_clients, min_ns, writes);
+
+    if (stress_threads && !num_chips && !dtb && !multi)
+    {
+        printf("The stress test only runs on simulated registers (-c, -d or -m)\n");
+        return 1;
+    }
+
+    if ((num_chips || dtb || multi) && !sim)
+        sim = "/dev/shm/gpiobench";
+
+    if (multi)
+    {
+        if (snprintf(dt_dir, sizeof(dt_dir), "%s/dt", sim) >= (int)sizeof(dt_dir) ||
+            write_multi_dt(dt_dir) != 0)
+        {
+            printf("Failed to write a Device Tree to %s\n", dt_dir);
+            return 1;
+        }
+        dtb = dt_dir;
+    }
+
+    if (num_chips <= 1)
+        return bench_chip(num_chips ? chips[0] : NULL, dtb, sim, min_ns, writes);
+
+    // gpiolib can only be initialised once, so give each chip a process
+    for (i = 0; i < num_chips; i++)
+    {
+        pid_t pid;
+        int status;
+
+        fflush(stdout);
+        pid = fork();
+        if (pid < 0)
+            return 1;
+        if (pid == 0)
+            exit(bench_chip(chips[i], NULL, sim, min_ns, writes));
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            continue;
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            ret = 1;
+    }
+
+    return ret;
+}
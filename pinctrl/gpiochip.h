@@ -14,6 +14,20 @@
 
 typedef struct GPIO_CHIP_INTERFACE_ GPIO_CHIP_INTERFACE_T;
 
+#define GPIO_MAX_DRIVE_BANKS 3
+
+/* A pair of registers that drive some of a window of GPIOs high and low
+ * with a plain store. Bit n of the window is bit n + shift of the
+ * registers (shift may be negative).
+ */
+typedef struct
+{
+    volatile uint32_t *set;
+    volatile uint32_t *clr;
+    uint32_t mask;  /* The window bits this bank covers */
+    int shift;
+} GPIO_DRIVE_BANK_T;
+
 typedef struct GPIO_CHIP_
 {
     const char *name;
@@ -26,6 +40,7 @@ typedef struct GPIO_CHIP_
 struct GPIO_CHIP_INTERFACE_
 {
     void * (*gpio_create_instance)(const GPIO_CHIP_T *chip, const char *dtnode);
+    void (*gpio_destroy_instance)(void *priv);  /* Optional - undoes create */
     int (*gpio_count)(void *priv);
     void * (*gpio_probe_instance)(void *priv, volatile uint32_t *base);
     GPIO_FSEL_T (*gpio_get_fsel)(void *priv, uint32_t gpio);
@@ -39,8 +54,45 @@ struct GPIO_CHIP_INTERFACE_
     void (*gpio_set_pull)(void *priv, uint32_t gpio, GPIO_PULL_T pull);
     const char * (*gpio_get_name)(void *priv, uint32_t gpio);
     const char * (*gpio_get_fsel_name)(void *priv, uint32_t gpio, GPIO_FSEL_T fsel);
+    void (*gpio_get_state)(void *priv, uint32_t first, uint32_t count,
+                           GPIO_PIN_STATE_T *states);  /* Optional bulk read */
+    int (*gpio_get_levels)(void *priv, uint32_t first, uint32_t mask,
+                           uint32_t *levels);  /* Optional bank-wide read */
+    int (*gpio_get_dirs)(void *priv, uint32_t first, uint32_t mask,
+                         uint32_t *dirs);  /* Optional - set for outputs */
+    int (*gpio_get_edges)(void *priv, uint32_t first, uint32_t mask,
+                          uint32_t *rising, uint32_t *falling);  /* Optional */
+    void (*gpio_update_drives)(void *priv, uint32_t first, uint32_t set_mask,
+                               uint32_t clr_mask, uint32_t xor_mask);  /* Optional */
+    int (*gpio_get_drive_banks)(void *priv, uint32_t first,
+                                GPIO_DRIVE_BANK_T *banks);  /* Optional */
+    int (*gpio_get_pad)(void *priv, uint32_t gpio);  /* Optional raw pad bits */
+    void (*gpio_set_pad)(void *priv, uint32_t gpio, uint32_t pad);  /* Optional */
+    void (*gpio_apply_config)(void *priv, uint32_t first, uint32_t count,
+                              const GPIO_PIN_CONFIG_T *configs);  /* Optional */
+    void (*gpio_set_pulls)(void *priv, uint32_t first, uint32_t mask,
+                           GPIO_PULL_T pull);  /* Optional */
+    void (*gpio_set_fsels)(void *priv, uint32_t first, uint32_t mask,
+                           GPIO_FSEL_T func);  /* Optional */
+    int (*gpio_get_pad_ctrl)(void *priv, uint32_t gpio,
+                             GPIO_PAD_CTRL_T *ctrl);  /* Optional */
+    void (*gpio_set_pad_ctrl)(void *priv, uint32_t gpio,
+                              const GPIO_PAD_CTRL_T *ctrl);  /* Optional */
+    void (*gpio_set_pad_ctrls)(void *priv, uint32_t first, uint32_t mask,
+                               const GPIO_PAD_CTRL_T *ctrl);  /* Optional */
 };
 
+/* Serialise a read-modify-write of a shared register - no-ops unless
+ * gpiolib_set_thread_safe has been called. Never nest them.
+ */
+void gpio_reg_lock(volatile uint32_t *reg);
+void gpio_reg_unlock(volatile uint32_t *reg);
+
+/* Non-zero if the registers are gpiolib_set_sim images rather than the
+ * hardware, for backends that need to emulate special registers.
+ */
+int gpio_regs_simulated(void);
+
 #if LIBRARY_BUILD
 extern const GPIO_CHIP_T *const library_gpiochips[];
 extern const int library_gpiochips_count;
@@ -27,10 +27,19 @@
 #define FLAGS_GPIO             8
 #define FLAGS_PINCTRL          16
 
+/* Where one GPIO's field of the pinmux or pad registers lives */
+struct bcm2712_field
+{
+    volatile uint32_t *reg;     /* NULL if the GPIO has no such field */
+    unsigned shift;
+};
+
 struct bcm2712_inst
 {
     volatile uint32_t *gpio_base;
     volatile uint32_t *pinmux_base;
+    struct bcm2712_field *pinmux_fields;    /* Per GPIO, built at probe */
+    struct bcm2712_field *pad_fields;
     unsigned pad_offset;
     uint32_t *bank_widths;
     unsigned flags;
@@ -42,6 +51,17 @@ static unsigned num_instances;
 static struct bcm2712_inst bcm2712_instances[BCM2712_MAX_INSTANCES] = { 0 };
 static unsigned shared_flags;
 
+/* The bank widths normally come from the GPIO node - these are for pinctrl
+ * instances without one, e.g. from gpiolib_init_by_name.
+ */
+static uint32_t bcm2712_default_widths[][2] =
+{
+    { 32, 22 },     // C0
+    { 32, 4 },      // D0
+    { 17, 6 },      // C0 AON
+    { 15, 6 },      // D0 AON
+};
+
 static const char *bcm2712_c0_gpio_alt_names[][BCM2712_FSEL_COUNT - 1] =
 {
     { "BSC_M3_SDA"             , "VC_SDA0"          , "GPCLK0"           , "ENET0_LINK"        , "VC_PWM1_0"             , "VC_SPI0_CE1_N"         , "IR_IN"          , }, // 0
@@ -236,9 +256,22 @@ static volatile uint32_t *bcm2712_gpio_base(struct bcm2712_inst *inst,
     return inst->gpio_base + bank * (0x20 / 4);
 }
 
-static volatile uint32_t *bcm2712_pinmux_base(struct bcm2712_inst *inst,
-                                              unsigned gpio,
-                                              unsigned int *bit)
+static uint32_t bcm2712_gpio_get_bank_levels(struct bcm2712_inst *inst,
+                                             unsigned bank)
+{
+    return inst->gpio_base[bank * (0x20 / 4) + BCM2712_GIO_DATA / 4];
+}
+
+/* A set bit is an input */
+static uint32_t bcm2712_gpio_get_bank_dirs(struct bcm2712_inst *inst,
+                                           unsigned bank)
+{
+    return inst->gpio_base[bank * (0x20 / 4) + BCM2712_GIO_IODIR / 4];
+}
+
+static volatile uint32_t *bcm2712_pinmux_locate(struct bcm2712_inst *inst,
+                                                unsigned gpio,
+                                                unsigned int *bit)
 {
     unsigned bank, gpio_offset;
 
@@ -288,9 +321,9 @@ static volatile uint32_t *bcm2712_pinmux_base(struct bcm2712_inst *inst,
     return inst->pinmux_base + (bank * 4) + (gpio_offset / 8);
 }
 
-static volatile uint32_t *bcm2712_pad_base(struct bcm2712_inst *inst,
-                                           unsigned gpio,
-                                           unsigned int *bit)
+static volatile uint32_t *bcm2712_pad_locate(struct bcm2712_inst *inst,
+                                             unsigned gpio,
+                                             unsigned int *bit)
 {
     unsigned bank, gpio_offset;
 
@@ -324,6 +357,53 @@ static volatile uint32_t *bcm2712_pad_base(struct bcm2712_inst *inst,
     return inst->pinmux_base + (gpio / 15);
 }
 
+/* The layouts differ between the C0, D0 and AON variants, so look each GPIO
+ * up once, when the pinctrl registers are mapped.
+ */
+static int bcm2712_build_fields(struct bcm2712_inst *inst)
+{
+    unsigned gpio;
+
+    inst->pinmux_fields = calloc(inst->num_gpios, sizeof(struct bcm2712_field));
+    inst->pad_fields = calloc(inst->num_gpios, sizeof(struct bcm2712_field));
+    if (!inst->pinmux_fields || !inst->pad_fields)
+        return -1;
+
+    for (gpio = 0; gpio < inst->num_gpios; gpio++)
+    {
+        struct bcm2712_field *field;
+
+        field = &inst->pinmux_fields[gpio];
+        field->reg = bcm2712_pinmux_locate(inst, gpio, &field->shift);
+        field = &inst->pad_fields[gpio];
+        field->reg = bcm2712_pad_locate(inst, gpio, &field->shift);
+    }
+
+    return 0;
+}
+
+static volatile uint32_t *bcm2712_pinmux_base(struct bcm2712_inst *inst,
+                                              unsigned gpio,
+                                              unsigned int *bit)
+{
+    if (gpio >= inst->num_gpios || !inst->pinmux_fields)
+        return NULL;
+
+    *bit = inst->pinmux_fields[gpio].shift;
+    return inst->pinmux_fields[gpio].reg;
+}
+
+static volatile uint32_t *bcm2712_pad_base(struct bcm2712_inst *inst,
+                                           unsigned gpio,
+                                           unsigned int *bit)
+{
+    if (gpio >= inst->num_gpios || !inst->pad_fields)
+        return NULL;
+
+    *bit = inst->pad_fields[gpio].shift;
+    return inst->pad_fields[gpio].reg;
+}
+
 static int bcm2712_gpio_get_level(void *priv, unsigned gpio)
 {
     struct bcm2712_inst *inst = priv;
@@ -333,7 +413,57 @@ static int bcm2712_gpio_get_level(void *priv, unsigned gpio)
     if (!gpio_base)
         return -1;
 
-    return !!(gpio_base[BCM2712_GIO_DATA / 4] & (1 << bit));
+    return !!(bcm2712_gpio_get_bank_levels(inst, gpio / 32) & (1U << bit));
+}
+
+static int bcm2712_gpio_get_levels(void *priv, uint32_t first, uint32_t mask,
+                                   uint32_t *levels)
+{
+    struct bcm2712_inst *inst = priv;
+    unsigned bank;
+
+    if (!inst->gpio_base)
+        return -1;
+
+    *levels = 0;
+    for (bank = first / 32; bank <= (first + 31) / 32 && bank < inst->num_banks; bank++)
+    {
+        int shift = bank * 32 - first;
+        uint32_t bank_mask, data;
+
+        bank_mask = (shift >= 0) ? (mask >> shift) : (mask << -shift);
+        if (!bank_mask)
+            continue;
+        data = bcm2712_gpio_get_bank_levels(inst, bank) & bank_mask;
+        *levels |= (shift >= 0) ? (data << shift) : (data >> -shift);
+    }
+
+    return 0;
+}
+
+static int bcm2712_gpio_get_dirs(void *priv, uint32_t first, uint32_t mask,
+                                 uint32_t *dirs)
+{
+    struct bcm2712_inst *inst = priv;
+    unsigned bank;
+
+    if (!inst->gpio_base)
+        return -1;
+
+    *dirs = 0;
+    for (bank = first / 32; bank <= (first + 31) / 32 && bank < inst->num_banks; bank++)
+    {
+        int shift = bank * 32 - first;
+        uint32_t bank_mask, data;
+
+        bank_mask = (shift >= 0) ? (mask >> shift) : (mask << -shift);
+        if (!bank_mask)
+            continue;
+        data = ~bcm2712_gpio_get_bank_dirs(inst, bank) & bank_mask;
+        *dirs |= (shift >= 0) ? (data << shift) : (data >> -shift);
+    }
+
+    return 0;
 }
 
 static void bcm2712_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
@@ -346,9 +476,38 @@ static void bcm2712_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
     if (!gpio_base)
         return;
 
+    gpio_reg_lock(&gpio_base[BCM2712_GIO_DATA / 4]);
     gpio_val = gpio_base[BCM2712_GIO_DATA / 4];
     gpio_val = (gpio_val & ~(1U << bit)) | (drv << bit);
     gpio_base[BCM2712_GIO_DATA / 4] = gpio_val;
+    gpio_reg_unlock(&gpio_base[BCM2712_GIO_DATA / 4]);
+}
+
+static void bcm2712_gpio_update_drives(void *priv, uint32_t first, uint32_t set_mask,
+                                       uint32_t clr_mask, uint32_t xor_mask)
+{
+    struct bcm2712_inst *inst = priv;
+    unsigned bank;
+
+    if (!inst->gpio_base)
+        return;
+
+    for (bank = first / 32; bank <= (first + 31) / 32 && bank < inst->num_banks; bank++)
+    {
+        volatile uint32_t *data = &inst->gpio_base[bank * (0x20 / 4) + BCM2712_GIO_DATA / 4];
+        int shift = bank * 32 - first;
+        uint32_t set, clr, xor;
+
+        set = (shift >= 0) ? (set_mask >> shift) : (set_mask << -shift);
+        clr = (shift >= 0) ? (clr_mask >> shift) : (clr_mask << -shift);
+        xor = (shift >= 0) ? (xor_mask >> shift) : (xor_mask << -shift);
+        if (set | clr | xor)
+        {
+            gpio_reg_lock(data);
+            *data = ((*data & ~clr) | set) ^ xor;
+            gpio_reg_unlock(data);
+        }
+    }
 }
 
 static GPIO_DRIVE_T bcm2712_gpio_get_drive(void *priv, unsigned gpio)
@@ -375,10 +534,12 @@ static void bcm2712_gpio_set_dir(void *priv, unsigned gpio, GPIO_DIR_T dir)
     if (!gpio_base)
         return;
 
+    gpio_reg_lock(&gpio_base[BCM2712_GIO_IODIR / 4]);
     gpio_val = gpio_base[BCM2712_GIO_IODIR / 4];
     gpio_val &= ~(1U << bit);
     gpio_val |= ((dir == DIR_INPUT) << bit);
     gpio_base[BCM2712_GIO_IODIR / 4] = gpio_val;
+    gpio_reg_unlock(&gpio_base[BCM2712_GIO_IODIR / 4]);
 }
 
 static GPIO_DIR_T bcm2712_gpio_get_dir(void *priv, unsigned gpio)
@@ -386,13 +547,40 @@ static GPIO_DIR_T bcm2712_gpio_get_dir(void *priv, unsigned gpio)
     struct bcm2712_inst *inst = priv;
     unsigned int bit;
     volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
-    uint32_t gpio_val;
 
     if (!gpio_base)
         return DIR_MAX;
 
-    gpio_val = gpio_base[BCM2712_GIO_IODIR / 4];
-    return (gpio_val & (1U << bit)) ? DIR_INPUT : DIR_OUTPUT;
+    return (bcm2712_gpio_get_bank_dirs(inst, gpio / 32) & (1U << bit)) ?
+        DIR_INPUT : DIR_OUTPUT;
+}
+
+static GPIO_FSEL_T bcm2712_decode_fsel(int fsel)
+{
+    if (fsel == 0)
+        return GPIO_FSEL_GPIO;
+    else if (fsel < BCM2712_FSEL_COUNT)
+        return GPIO_FSEL_FUNC1 + (fsel - 1);
+    else if (fsel == 0xf) // Choose one value as a considered NONE
+        return GPIO_FSEL_NONE;
+
+    /* Unknown FSEL */
+    return -1;
+}
+
+static GPIO_PULL_T bcm2712_decode_pull(uint32_t pad_val)
+{
+    switch (pad_val)
+    {
+    case BCM2712_PAD_PULL_OFF:
+        return PULL_NONE;
+    case BCM2712_PAD_PULL_DOWN:
+        return PULL_DOWN;
+    case BCM2712_PAD_PULL_UP:
+        return PULL_UP;
+    default:
+        return PULL_MAX; /* This is an error */
+    }
 }
 
 static GPIO_FSEL_T bcm2712_pinctrl_get_fsel(void *priv, unsigned gpio)
@@ -407,15 +595,7 @@ static GPIO_FSEL_T bcm2712_pinctrl_get_fsel(void *priv, unsigned gpio)
 
     fsel = ((*pinmux_base >> pinmux_bit) & 0xf);
 
-    if (fsel == 0)
-        return GPIO_FSEL_GPIO;
-    else if (fsel < BCM2712_FSEL_COUNT)
-        return GPIO_FSEL_FUNC1 + (fsel - 1);
-    else if (fsel == 0xf) // Choose one value as a considered NONE
-        return GPIO_FSEL_NONE;
-
-    /* Unknown FSEL */
-    return -1;
+    return bcm2712_decode_fsel(fsel);
 }
 
 static void bcm2712_pinctrl_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
@@ -448,10 +628,12 @@ static void bcm2712_pinctrl_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_
         return;
     }
 
+    gpio_reg_lock(pinmux_base);
     pinmux_val = *pinmux_base;
     pinmux_val &= ~(0xf << pinmux_bit);
     pinmux_val |= (fsel << pinmux_bit);
     *pinmux_base = pinmux_val;
+    gpio_reg_unlock(pinmux_base);
 }
 
 static GPIO_PULL_T bcm2712_pinctrl_get_pull(void *priv, unsigned gpio)
@@ -465,17 +647,7 @@ static GPIO_PULL_T bcm2712_pinctrl_get_pull(void *priv, unsigned gpio)
         return PULL_MAX;
 
     pad_val = (*pad_base >> bit) & 0x3;
-    switch (pad_val)
-    {
-    case BCM2712_PAD_PULL_OFF:
-        return PULL_NONE;
-    case BCM2712_PAD_PULL_DOWN:
-        return PULL_DOWN;
-    case BCM2712_PAD_PULL_UP:
-        return PULL_UP;
-    default:
-        return PULL_MAX; /* This is an error */
-    }
+    return bcm2712_decode_pull(pad_val);
 }
 
 static void bcm2712_pinctrl_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
@@ -505,11 +677,68 @@ static void bcm2712_pinctrl_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull
         return;
     }
 
+    gpio_reg_lock(pad_base);
     padval = *pad_base;
     padval &= ~(3 << bit);
     padval |= (val << bit);
 
     *pad_base = padval;
+    gpio_reg_unlock(pad_base);
+}
+
+static void bcm2712_get_state(void *priv, uint32_t first, uint32_t count,
+                              GPIO_PIN_STATE_T *states)
+{
+    struct bcm2712_inst *inst = priv;
+    volatile uint32_t *cur_pinmux = NULL, *cur_pad = NULL;
+    uint32_t data = 0, iodir = 0, pinmux = 0, pad = 0;
+    unsigned cur_bank = ~0U;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_PIN_STATE_T *state = &states[i];
+        volatile uint32_t *reg;
+        unsigned int bit;
+
+        // Each register is only read when moving on to a new word
+        if (bcm2712_gpio_base(inst, first + i, &bit))
+        {
+            unsigned bank = (first + i) / 32;
+
+            if (bank != cur_bank)
+            {
+                data = bcm2712_gpio_get_bank_levels(inst, bank);
+                iodir = bcm2712_gpio_get_bank_dirs(inst, bank);
+                cur_bank = bank;
+            }
+            state->dir = (iodir & (1U << bit)) ? DIR_INPUT : DIR_OUTPUT;
+            state->drive = (data & (1U << bit)) ? DRIVE_HIGH : DRIVE_LOW;
+            state->level = !!(data & (1U << bit));
+        }
+
+        reg = bcm2712_pinmux_base(inst, first + i, &bit);
+        if (reg)
+        {
+            if (reg != cur_pinmux)
+            {
+                pinmux = *reg;
+                cur_pinmux = reg;
+            }
+            state->fsel = bcm2712_decode_fsel((pinmux >> bit) & 0xf);
+        }
+
+        reg = bcm2712_pad_base(inst, first + i, &bit);
+        if (reg)
+        {
+            if (reg != cur_pad)
+            {
+                pad = *reg;
+                cur_pad = reg;
+            }
+            state->pull = bcm2712_decode_pull((pad >> bit) & 0x3);
+        }
+    }
 }
 
 static void *bcm2712_gpio_create_instance(const GPIO_CHIP_T *chip,
@@ -601,6 +830,41 @@ static void *bcm2712_gpio_probe_instance(void *priv, volatile uint32_t *base)
     return inst;
 }
 
+/* Return a pool slot once neither of its nodes uses it, and start the pool
+ * afresh once it is empty.
+ */
+static void bcm2712_release_instance(struct bcm2712_inst *inst)
+{
+    unsigned i;
+
+    if (inst->flags & (FLAGS_GPIO | FLAGS_PINCTRL))
+        return;
+
+    free(inst->pinmux_fields);
+    free(inst->pad_fields);
+    memset(inst, 0, sizeof(*inst));
+
+    for (i = 0; i < num_instances; i++)
+    {
+        if (bcm2712_instances[i].flags & (FLAGS_GPIO | FLAGS_PINCTRL))
+            return;
+    }
+    num_instances = 0;
+    shared_flags = 0;
+}
+
+static void bcm2712_gpio_destroy_instance(void *priv)
+{
+    struct bcm2712_inst *inst = priv;
+
+    dt_free(inst->bank_widths);
+    inst->bank_widths = NULL;
+    inst->num_gpios = 0;
+    inst->num_banks = 0;
+    inst->flags &= ~FLAGS_GPIO;
+    bcm2712_release_instance(inst);
+}
+
 static void *bcm2712_pinctrl_create_instance(const GPIO_CHIP_T *chip,
                                              const char *dtnode)
 {
@@ -668,6 +932,20 @@ static void *bcm2712_pinctrl_create_instance(const GPIO_CHIP_T *chip,
     return (void *)inst;
 }
 
+static void bcm2712_pinctrl_destroy_instance(void *priv)
+{
+    struct bcm2712_inst *inst = priv;
+
+    /* The bank widths are the GPIO node's, or one of the defaults */
+    if (!(inst->flags & FLAGS_GPIO))
+    {
+        inst->bank_widths = NULL;
+        inst->num_gpios = 0;
+    }
+    inst->flags &= ~FLAGS_PINCTRL;
+    bcm2712_release_instance(inst);
+}
+
 static int bcm2712_pinctrl_count(void *priv)
 {
     struct bcm2712_inst *inst = priv;
@@ -682,18 +960,26 @@ static int bcm2712_pinctrl_count(void *priv)
         case 0:
         case FLAGS_C0:
             inst->num_gpios = 54;
+            inst->bank_widths = bcm2712_default_widths[0];
             break;
         case FLAGS_D0:
             inst->num_gpios = 36;
+            inst->bank_widths = bcm2712_default_widths[1];
             break;
         case FLAGS_AON:
-        case FLAGS_AON | FLAGS_D0:
         case FLAGS_AON | FLAGS_C0:
             inst->num_gpios = 38;
+            inst->bank_widths = bcm2712_default_widths[2];
+            break;
+        case FLAGS_AON | FLAGS_D0:
+            inst->num_gpios = 38;
+            inst->bank_widths = bcm2712_default_widths[3];
             break;
         default:
             break;
         }
+        if (inst->bank_widths)
+            inst->num_banks = 2;
     }
     return inst->num_gpios;
 }
@@ -724,6 +1010,9 @@ static void *bcm2712_pinctrl_probe_instance(void *priv, volatile uint32_t *base)
 
     inst->pad_offset = pad_offset;
 
+    if (bcm2712_build_fields(inst) != 0)
+        return NULL;
+
     return inst;
 }
 
@@ -821,6 +1110,7 @@ static const char *bcm2712_gpio_get_name(void *priv, unsigned gpio)
 static const GPIO_CHIP_INTERFACE_T bcm2712_gpio_interface =
 {
     .gpio_create_instance = bcm2712_gpio_create_instance,
+    .gpio_destroy_instance = bcm2712_gpio_destroy_instance,
     .gpio_count = bcm2712_gpio_count,
     .gpio_probe_instance = bcm2712_gpio_probe_instance,
     .gpio_get_fsel = bcm2712_pinctrl_get_fsel,
@@ -834,6 +1124,10 @@ static const GPIO_CHIP_INTERFACE_T bcm2712_gpio_interface =
     .gpio_set_pull = bcm2712_pinctrl_set_pull,
     .gpio_get_name = bcm2712_gpio_get_name,
     .gpio_get_fsel_name = bcm2712_pinctrl_get_fsel_name,
+    .gpio_get_state = bcm2712_get_state,
+    .gpio_get_levels = bcm2712_gpio_get_levels,
+    .gpio_get_dirs = bcm2712_gpio_get_dirs,
+    .gpio_update_drives = bcm2712_gpio_update_drives,
 };
 
 DECLARE_GPIO_CHIP(brcmstb, "brcm,brcmstb-gpio",
@@ -842,6 +1136,7 @@ DECLARE_GPIO_CHIP(brcmstb, "brcm,brcmstb-gpio",
 static const GPIO_CHIP_INTERFACE_T bcm2712_pinctrl_interface =
 {
     .gpio_create_instance = bcm2712_pinctrl_create_instance,
+    .gpio_destroy_instance = bcm2712_pinctrl_destroy_instance,
     .gpio_count = bcm2712_pinctrl_count,
     .gpio_probe_instance = bcm2712_pinctrl_probe_instance,
     .gpio_get_fsel = bcm2712_pinctrl_get_fsel,
@@ -855,6 +1150,10 @@ static const GPIO_CHIP_INTERFACE_T bcm2712_pinctrl_interface =
     .gpio_set_pull = bcm2712_pinctrl_set_pull,
     .gpio_get_name = bcm2712_gpio_get_name,
     .gpio_get_fsel_name = bcm2712_pinctrl_get_fsel_name,
+    .gpio_get_state = bcm2712_get_state,
+    .gpio_get_levels = bcm2712_gpio_get_levels,
+    .gpio_get_dirs = bcm2712_gpio_get_dirs,
+    .gpio_update_drives = bcm2712_gpio_update_drives,
 };
 
 DECLARE_GPIO_CHIP(bcm2712, "brcm,bcm2712-pinctrl",
@@ -1,5 +1,6 @@
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,14 +38,33 @@
 #define GPPUPPDN2    59        /* Pin pull-up/down for pins 47:32 */
 #define GPPUPPDN3    60        /* Pin pull-up/down for pins 57:48 */
 
+/* Where one GPIO's field of a GPFSEL or GPPUPPDN register lives */
+struct bcm2835_slot
+{
+    uint8_t reg;
+    uint8_t shift;
+    uint32_t mask;
+};
+
 struct bcm2835_inst
 {
     unsigned num_gpios;
     volatile uint32_t *base;
+    struct bcm2835_slot fsel_slots[BCM2711_NUM_GPIOS];
+    struct bcm2835_slot pull_slots[BCM2711_NUM_GPIOS];
+    pthread_mutex_t pud_lock;   /* Held across the GPPUD sequence */
 };
 
-static struct bcm2835_inst bcm2835_instance = { .num_gpios = BCM2835_NUM_GPIOS };
-static struct bcm2835_inst bcm2711_instance = { .num_gpios = BCM2711_NUM_GPIOS };
+static struct bcm2835_inst bcm2835_instance =
+{
+    .num_gpios = BCM2835_NUM_GPIOS,
+    .pud_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static struct bcm2835_inst bcm2711_instance =
+{
+    .num_gpios = BCM2711_NUM_GPIOS,
+    .pud_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 static const char *bcm2835_gpio_alt_names[BCM2835_NUM_GPIOS][BCM2835_ALT_COUNT] =
 {
@@ -167,57 +187,134 @@ static const char *bcm2711_gpio_alt_names[BCM2711_NUM_GPIOS][BCM2711_ALT_COUNT]
     { 0           , 0            , 0           , 0               , 0                 , 0             , },
 };
 
+static const GPIO_FSEL_T bcm2835_fsels[8] =
+{
+    GPIO_FSEL_INPUT, GPIO_FSEL_OUTPUT, GPIO_FSEL_FUNC5, GPIO_FSEL_FUNC4,
+    GPIO_FSEL_FUNC0, GPIO_FSEL_FUNC1, GPIO_FSEL_FUNC2, GPIO_FSEL_FUNC3
+};
+
+static void bcm2835_build_slots(struct bcm2835_inst *inst)
+{
+    unsigned gpio;
+
+    for (gpio = 0; gpio < inst->num_gpios; gpio++)
+    {
+        struct bcm2835_slot *slot;
+
+        /* GPFSEL0-5 with 10 sels per reg, 3 bits per sel (so bits 0:29 used) */
+        slot = &inst->fsel_slots[gpio];
+        slot->reg = GPFSEL0 + (gpio / 10);
+        slot->shift = (gpio % 10) * 3;
+        slot->mask = 7U << slot->shift;
+
+        /* GPPUPPDN0-3 with 16 pulls per reg, 2 bits per pull (2711 only) */
+        slot = &inst->pull_slots[gpio];
+        slot->reg = GPPUPPDN0 + (gpio / 16);
+        slot->shift = (gpio % 16) * 2;
+        slot->mask = 3U << slot->shift;
+    }
+}
+
 static GPIO_FSEL_T bcm2835_gpio_get_fsel(void *priv, unsigned gpio)
 {
     struct bcm2835_inst *inst = priv;
-    volatile uint32_t *base = inst->base;
-    /* GPFSEL0-5 with 10 sels per reg, 3 bits per sel (so bits 0:29 used) */
-    uint32_t reg = GPFSEL0 + (gpio / 10);
-    uint32_t lsb = (gpio % 10) * 3;
+    const struct bcm2835_slot *slot;
 
     if (gpio < inst->num_gpios)
     {
-        switch ((base[reg] >> lsb) & 7)
-        {
-        case 0: return GPIO_FSEL_INPUT;
-        case 1: return GPIO_FSEL_OUTPUT;
-        case 2: return GPIO_FSEL_FUNC5;
-        case 3: return GPIO_FSEL_FUNC4;
-        case 4: return GPIO_FSEL_FUNC0;
-        case 5: return GPIO_FSEL_FUNC1;
-        case 6: return GPIO_FSEL_FUNC2;
-        case 7: return GPIO_FSEL_FUNC3;
-        }
+        slot = &inst->fsel_slots[gpio];
+        return bcm2835_fsels[(inst->base[slot->reg] >> slot->shift) & 7];
     }
 
     return GPIO_FSEL_MAX;
 }
 
+/* The GPFSEL field value for a function, or -1 if there isn't one */
+static int bcm2835_fsel_code(GPIO_FSEL_T func)
+{
+    switch (func)
+    {
+    case GPIO_FSEL_INPUT: return 0;
+    case GPIO_FSEL_OUTPUT: return 1;
+    case GPIO_FSEL_FUNC0: return 4;
+    case GPIO_FSEL_FUNC1: return 5;
+    case GPIO_FSEL_FUNC2: return 6;
+    case GPIO_FSEL_FUNC3: return 7;
+    case GPIO_FSEL_FUNC4: return 3;
+    case GPIO_FSEL_FUNC5: return 2;
+    default: return -1;
+    }
+}
+
 static void bcm2835_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
 {
     struct bcm2835_inst *inst = priv;
+    const struct bcm2835_slot *slot;
+    volatile uint32_t *reg;
+    int fsel = bcm2835_fsel_code(func);
+
+    if (fsel < 0)
+        return;
+
+    if (gpio < inst->num_gpios)
+    {
+        slot = &inst->fsel_slots[gpio];
+        reg = &inst->base[slot->reg];
+        gpio_reg_lock(reg);
+        *reg = (*reg & ~slot->mask) | ((uint32_t)fsel << slot->shift);
+        gpio_reg_unlock(reg);
+    }
+}
+
+/* Merge the given fields into each GPFSEL register with at most one
+ * read-modify-write, skipping any that wouldn't change.
+ */
+static void bcm2835_gpio_update_fsels(struct bcm2835_inst *inst,
+                                      const uint32_t *fsel_vals,
+                                      const uint32_t *fsel_masks)
+{
     volatile uint32_t *base = inst->base;
-    /* GPFSEL0-5 with 10 sels per reg, 3 bits per sel (so bits 0:29 used) */
-    uint32_t reg = GPFSEL0 + (gpio / 10);
-    uint32_t lsb = (gpio % 10) * 3;
-    int fsel;
+    uint32_t i;
 
-    switch (func)
+    for (i = 0; i <= GPFSEL5; i++)
     {
-    case GPIO_FSEL_INPUT: fsel = 0; break;
-    case GPIO_FSEL_OUTPUT: fsel = 1; break;
-    case GPIO_FSEL_FUNC0: fsel = 4; break;
-    case GPIO_FSEL_FUNC1: fsel = 5; break;
-    case GPIO_FSEL_FUNC2: fsel = 6; break;
-    case GPIO_FSEL_FUNC3: fsel = 7; break;
-    case GPIO_FSEL_FUNC4: fsel = 3; break;
-    case GPIO_FSEL_FUNC5: fsel = 2; break;
-    default:
+        volatile uint32_t *reg = &base[GPFSEL0 + i];
+        uint32_t old, val;
+
+        if (!fsel_masks[i])
+            continue;
+        gpio_reg_lock(reg);
+        old = *reg;
+        val = (old & ~fsel_masks[i]) | fsel_vals[i];
+        if (val != old)
+            *reg = val;
+        gpio_reg_unlock(reg);
+    }
+}
+
+static void bcm2835_gpio_set_fsels(void *priv, uint32_t first, uint32_t mask,
+                                   GPIO_FSEL_T func)
+{
+    struct bcm2835_inst *inst = priv;
+    int fsel = bcm2835_fsel_code(func);
+    uint32_t fsel_vals[GPFSEL5 + 1] = { 0 };
+    uint32_t fsel_masks[GPFSEL5 + 1] = { 0 };
+    uint32_t gpio;
+
+    if (fsel < 0)
         return;
+
+    for (gpio = first; gpio < inst->num_gpios && gpio - first < 32; gpio++)
+    {
+        const struct bcm2835_slot *slot = &inst->fsel_slots[gpio];
+
+        if (!(mask & (1U << (gpio - first))))
+            continue;
+        fsel_vals[slot->reg - GPFSEL0] |= (uint32_t)fsel << slot->shift;
+        fsel_masks[slot->reg - GPFSEL0] |= slot->mask;
     }
 
-    if (gpio < inst->num_gpios)
-        base[reg] = (base[reg] & ~(0x7 << lsb)) | (fsel << lsb);
+    bcm2835_gpio_update_fsels(inst, fsel_vals, fsel_masks);
 }
 
 static GPIO_DIR_T bcm2835_gpio_get_dir(void *priv, unsigned gpio)
@@ -255,6 +352,26 @@ static int bcm2835_gpio_get_level(void *priv, unsigned gpio)
     return (base[GPLEV0 + (gpio / 32)] >> (gpio % 32)) & 1;
 }
 
+static int bcm2835_gpio_get_levels(void *priv, uint32_t first, uint32_t mask,
+                                   uint32_t *levels)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    uint64_t wanted, lev = 0;
+
+    if (first >= inst->num_gpios)
+        return -1;
+
+    wanted = (uint64_t)mask << first;
+    if (wanted & 0xffffffff)
+        lev |= base[GPLEV0];
+    if (wanted >> 32)
+        lev |= (uint64_t)base[GPLEV1] << 32;
+
+    *levels = (uint32_t)(lev >> first) & mask;
+    return 0;
+}
+
 GPIO_DRIVE_T bcm2835_gpio_get_drive(void *priv, unsigned gpio)
 {
     /* This is a write-only mechanism */
@@ -272,6 +389,67 @@ static void bcm2835_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
         base[(drv ? GPSET0 : GPCLR0) + (gpio / 32)] = (1 << (gpio % 32));
 }
 
+static void bcm2835_gpio_update_drives(void *priv, uint32_t first, uint32_t set_mask,
+                                       uint32_t clr_mask, uint32_t xor_mask)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    uint64_t set_bits, clr_bits;
+
+    if (first >= inst->num_gpios)
+        return;
+
+    if (xor_mask)
+    {
+        /* There is no way to read back GPSET/GPCLR, so invert the level */
+        uint32_t levels;
+
+        bcm2835_gpio_get_levels(priv, first, xor_mask, &levels);
+        set_mask |= xor_mask & ~levels;
+        clr_mask |= xor_mask & levels;
+    }
+
+    set_bits = (uint64_t)set_mask << first;
+    clr_bits = (uint64_t)clr_mask << first;
+    if (set_bits & 0xffffffff)
+        base[GPSET0] = (uint32_t)set_bits;
+    if (set_bits >> 32)
+        base[GPSET1] = (uint32_t)(set_bits >> 32);
+    if (clr_bits & 0xffffffff)
+        base[GPCLR0] = (uint32_t)clr_bits;
+    if (clr_bits >> 32)
+        base[GPCLR1] = (uint32_t)(clr_bits >> 32);
+}
+
+static int bcm2835_gpio_get_drive_banks(void *priv, uint32_t first,
+                                        GPIO_DRIVE_BANK_T *banks)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    uint64_t gpio_bits;
+    int count = 0, bank;
+
+    if (first >= inst->num_gpios)
+        return -1;
+
+    gpio_bits = ((inst->num_gpios - first >= 32) ? 0xffffffffULL :
+                 (1ULL << (inst->num_gpios - first)) - 1) << first;
+    for (bank = 0; bank < 2; bank++)
+    {
+        uint64_t bank_bits = gpio_bits & (0xffffffffULL << (bank * 32));
+
+        if (!bank_bits)
+            continue;
+        banks[count].set = &base[GPSET0 + bank];
+        banks[count].clr = &base[GPCLR0 + bank];
+        banks[count].mask = (uint32_t)(bank_bits >> first);
+        banks[count].shift = (int)first - bank * 32;
+        count++;
+    }
+
+    return count;
+}
+
 static GPIO_PULL_T bcm2835_gpio_get_pull(void *priv, unsigned gpio)
 {
     /* This is a write-only mechanism */
@@ -280,24 +458,175 @@ static GPIO_PULL_T bcm2835_gpio_get_pull(void *priv, unsigned gpio)
     return PULL_MAX;
 }
 
-static void bcm2835_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
+/* Clock a pull into every GPIO in gpio_bits with a single GPPUD sequence -
+ * the pull is latched by each GPIO whose GPPUDCLK bit is set.
+ */
+static void bcm2835_gpio_clock_pull(struct bcm2835_inst *inst, uint64_t gpio_bits,
+                                    GPIO_PULL_T pull)
 {
-    struct bcm2835_inst *inst = priv;
     volatile uint32_t *base = inst->base;
-    int clkreg = GPPUDCLK0 + (gpio / 32);
-    int clkbit = 1 << (gpio % 32);
+    uint32_t clk0 = (uint32_t)gpio_bits;
+    uint32_t clk1 = (uint32_t)(gpio_bits >> 32);
 
-    if (gpio >= inst->num_gpios || pull < PULL_NONE || pull > PULL_UP)
+    if (!gpio_bits || pull < PULL_NONE || pull > PULL_UP)
         return;
 
+    /* The whole sequence shares GPPUD, so hold a lock throughout - one that
+     * sleeps, as the sequence takes 40us.
+     */
+    pthread_mutex_lock(&inst->pud_lock);
     base[GPPUD] = pull;
     usleep(10);
-    base[clkreg] = clkbit;
+    if (clk0)
+        base[GPPUDCLK0] = clk0;
+    if (clk1)
+        base[GPPUDCLK1] = clk1;
     usleep(10);
     base[GPPUD] = 0;
     usleep(10);
-    base[clkreg] = 0;
+    if (clk0)
+        base[GPPUDCLK0] = 0;
+    if (clk1)
+        base[GPPUDCLK1] = 0;
     usleep(10);
+    pthread_mutex_unlock(&inst->pud_lock);
+}
+
+static void bcm2835_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
+{
+    struct bcm2835_inst *inst = priv;
+
+    if (gpio < inst->num_gpios)
+        bcm2835_gpio_clock_pull(inst, 1ULL << gpio, pull);
+}
+
+static void bcm2835_gpio_set_pulls(void *priv, uint32_t first, uint32_t mask,
+                                   GPIO_PULL_T pull)
+{
+    struct bcm2835_inst *inst = priv;
+
+    if (first < inst->num_gpios)
+        bcm2835_gpio_clock_pull(inst, ((uint64_t)mask << first) &
+                                ((1ULL << inst->num_gpios) - 1), pull);
+}
+
+static void bcm2835_gpio_get_state(void *priv, uint32_t first, uint32_t count,
+                                   GPIO_PIN_STATE_T *states)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    uint32_t fsel_regs[GPFSEL5 + 1];
+    uint32_t lev_regs[2];
+    uint32_t i;
+
+    if (first >= inst->num_gpios || count > inst->num_gpios - first)
+        return;
+
+    /* Read each GPFSEL and GPLEV word covering the range just once */
+    for (i = first / 10; i <= (first + count - 1) / 10; i++)
+        fsel_regs[i] = base[GPFSEL0 + i];
+    for (i = first / 32; i <= (first + count - 1) / 32; i++)
+        lev_regs[i] = base[GPLEV0 + i];
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_PIN_STATE_T *state = &states[i];
+        uint32_t gpio = first + i;
+        const struct bcm2835_slot *slot = &inst->fsel_slots[gpio];
+        GPIO_FSEL_T fsel;
+
+        fsel = bcm2835_fsels[(fsel_regs[slot->reg - GPFSEL0] >> slot->shift) & 7];
+        state->fsel = fsel;
+        if (fsel == GPIO_FSEL_INPUT)
+            state->dir = DIR_INPUT;
+        else if (fsel == GPIO_FSEL_OUTPUT)
+            state->dir = DIR_OUTPUT;
+        else
+            state->dir = DIR_MAX;
+        state->drive = DRIVE_MAX; /* GPSET/GPCLR are write-only */
+        state->pull = PULL_MAX;   /* As is GPPUD */
+        state->level = (lev_regs[gpio / 32] >> (gpio % 32)) & 1;
+    }
+}
+
+/* Apply the functions and drives of a range of pins with at most one write
+ * to each GPFSEL, GPSET and GPCLR register, skipping any GPFSEL with nothing
+ * to change.
+ */
+static int bcm2835_gpio_apply_fsels(struct bcm2835_inst *inst, uint32_t first,
+                                    uint32_t count, const GPIO_PIN_CONFIG_T *configs)
+{
+    volatile uint32_t *base = inst->base;
+    uint32_t fsel_vals[GPFSEL5 + 1] = { 0 };
+    uint32_t fsel_masks[GPFSEL5 + 1] = { 0 };
+    uint64_t set_bits = 0, clr_bits = 0;
+    uint32_t i;
+
+    if (first >= inst->num_gpios || count > inst->num_gpios - first)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        const GPIO_PIN_CONFIG_T *config = &configs[i];
+        uint32_t gpio = first + i;
+        const struct bcm2835_slot *slot = &inst->fsel_slots[gpio];
+        int fsel = -1;
+
+        if (config->fsel != GPIO_FSEL_MAX)
+            fsel = bcm2835_fsel_code(config->fsel);
+        else if (config->dir == DIR_INPUT)
+            fsel = 0;
+        else if (config->dir == DIR_OUTPUT)
+            fsel = 1;
+        if (fsel >= 0)
+        {
+            fsel_vals[slot->reg - GPFSEL0] |= (uint32_t)fsel << slot->shift;
+            fsel_masks[slot->reg - GPFSEL0] |= slot->mask;
+        }
+
+        if (config->drive == DRIVE_HIGH)
+            set_bits |= 1ULL << gpio;
+        else if (config->drive == DRIVE_LOW)
+            clr_bits |= 1ULL << gpio;
+    }
+
+    /* GPSET/GPCLR can't be read back, and an output's level needn't match
+     * its drive, so every drive given is written. Do them first, so that
+     * new outputs start at the right level.
+     */
+    if (set_bits & 0xffffffff)
+        base[GPSET0] = (uint32_t)set_bits;
+    if (set_bits >> 32)
+        base[GPSET1] = (uint32_t)(set_bits >> 32);
+    if (clr_bits & 0xffffffff)
+        base[GPCLR0] = (uint32_t)clr_bits;
+    if (clr_bits >> 32)
+        base[GPCLR1] = (uint32_t)(clr_bits >> 32);
+
+    bcm2835_gpio_update_fsels(inst, fsel_vals, fsel_masks);
+
+    return 0;
+}
+
+static void bcm2835_gpio_apply_config(void *priv, uint32_t first, uint32_t count,
+                                      const GPIO_PIN_CONFIG_T *configs)
+{
+    uint64_t pull_bits[PULL_MAX] = { 0 };
+    uint32_t i;
+
+    if (bcm2835_gpio_apply_fsels(priv, first, count, configs) != 0)
+        return;
+
+    /* The pulls can't be read back, so any that are given must be written,
+     * but only one GPPUD sequence is needed for each pull
+     */
+    for (i = 0; i < count; i++)
+    {
+        if (configs[i].pull < PULL_MAX)
+            pull_bits[configs[i].pull] |= 1ULL << (first + i);
+    }
+    for (i = 0; i < PULL_MAX; i++)
+        bcm2835_gpio_clock_pull(priv, pull_bits[i], (GPIO_PULL_T)i);
 }
 
 static const char *bcm2835_gpio_get_name(void *priv, unsigned gpio)
@@ -344,13 +673,12 @@ static const char *bcm2835_gpio_get_fsel_name(void *priv, unsigned gpio, GPIO_FS
 static GPIO_PULL_T bcm2711_gpio_get_pull(void *priv, unsigned gpio)
 {
     struct bcm2835_inst *inst = priv;
-    volatile uint32_t *base = inst->base;
-    int reg = GPPUPPDN0 + (gpio / 16);
-    int lsb = (gpio % 16) * 2;
+    const struct bcm2835_slot *slot;
 
     if (gpio < BCM2711_NUM_GPIOS)
     {
-        switch ((base[reg] >> lsb) & 3)
+        slot = &inst->pull_slots[gpio];
+        switch ((inst->base[slot->reg] >> slot->shift) & 3)
         {
         case 0: return PULL_NONE;
         case 1: return PULL_UP;
@@ -361,33 +689,144 @@ static GPIO_PULL_T bcm2711_gpio_get_pull(void *priv, unsigned gpio)
     return PULL_MAX;
 }
 
+/* The GPPUPPDN field value for a pull, or -1 if there isn't one */
+static int bcm2711_pull_code(GPIO_PULL_T pull)
+{
+    switch (pull)
+    {
+    case PULL_NONE: return 0;
+    case PULL_UP: return 1;
+    case PULL_DOWN: return 2;
+    default: return -1;
+    }
+}
+
 static void bcm2711_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
+{
+    struct bcm2835_inst *inst = priv;
+    const struct bcm2835_slot *slot;
+    volatile uint32_t *reg;
+    int pull_val = bcm2711_pull_code(pull);
+
+    if (gpio >= BCM2711_NUM_GPIOS || pull_val < 0)
+        return;
+
+    slot = &inst->pull_slots[gpio];
+    reg = &inst->base[slot->reg];
+    gpio_reg_lock(reg);
+    *reg = (*reg & ~slot->mask) | ((uint32_t)pull_val << slot->shift);
+    gpio_reg_unlock(reg);
+}
+
+static void bcm2711_gpio_get_state(void *priv, uint32_t first, uint32_t count,
+                                   GPIO_PIN_STATE_T *states)
 {
     struct bcm2835_inst *inst = priv;
     volatile uint32_t *base = inst->base;
-    int reg = GPPUPPDN0 + (gpio / 16);
-    int lsb = (gpio % 16) * 2;
-    int pull_val;
+    uint32_t pull_reg = 0;
+    int cur_reg = -1;
+    uint32_t i;
+
+    bcm2835_gpio_get_state(priv, first, count, states);
 
-    if (gpio >= BCM2711_NUM_GPIOS)
+    if (first >= BCM2711_NUM_GPIOS || count > BCM2711_NUM_GPIOS - first)
         return;
 
-    switch (pull)
+    for (i = 0; i < count; i++)
     {
-    case PULL_NONE:
-        pull_val = 0;
-        break;
-    case PULL_UP:
-        pull_val = 1;
-        break;
-    case PULL_DOWN:
-        pull_val = 2;
-        break;
-    default:
+        const struct bcm2835_slot *slot = &inst->pull_slots[first + i];
+
+        if (slot->reg != cur_reg)
+        {
+            pull_reg = base[slot->reg];
+            cur_reg = slot->reg;
+        }
+
+        switch ((pull_reg >> slot->shift) & 3)
+        {
+        case 0: states[i].pull = PULL_NONE; break;
+        case 1: states[i].pull = PULL_UP; break;
+        case 2: states[i].pull = PULL_DOWN; break;
+        default: states[i].pull = PULL_MAX; break;
+        }
+    }
+}
+
+/* Merge the given fields into each GPPUPPDN register with at most one
+ * read-modify-write, skipping any that wouldn't change.
+ */
+static void bcm2711_gpio_update_pulls(struct bcm2835_inst *inst,
+                                      const uint32_t *pull_vals,
+                                      const uint32_t *pull_masks)
+{
+    volatile uint32_t *base = inst->base;
+    uint32_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        volatile uint32_t *reg = &base[GPPUPPDN0 + i];
+        uint32_t old, val;
+
+        if (!pull_masks[i])
+            continue;
+        gpio_reg_lock(reg);
+        old = *reg;
+        val = (old & ~pull_masks[i]) | pull_vals[i];
+        if (val != old)
+            *reg = val;
+        gpio_reg_unlock(reg);
+    }
+}
+
+static void bcm2711_gpio_set_pulls(void *priv, uint32_t first, uint32_t mask,
+                                   GPIO_PULL_T pull)
+{
+    struct bcm2835_inst *inst = priv;
+    int pull_val = bcm2711_pull_code(pull);
+    uint32_t pull_vals[4] = { 0 };
+    uint32_t pull_masks[4] = { 0 };
+    uint32_t gpio;
+
+    if (pull_val < 0)
+        return;
+
+    for (gpio = first; gpio < inst->num_gpios && gpio - first < 32; gpio++)
+    {
+        const struct bcm2835_slot *slot = &inst->pull_slots[gpio];
+
+        if (!(mask & (1U << (gpio - first))))
+            continue;
+        pull_vals[slot->reg - GPPUPPDN0] |= (uint32_t)pull_val << slot->shift;
+        pull_masks[slot->reg - GPPUPPDN0] |= slot->mask;
+    }
+
+    bcm2711_gpio_update_pulls(inst, pull_vals, pull_masks);
+}
+
+static void bcm2711_gpio_apply_config(void *priv, uint32_t first, uint32_t count,
+                                      const GPIO_PIN_CONFIG_T *configs)
+{
+    struct bcm2835_inst *inst = priv;
+    uint32_t pull_vals[4] = { 0 };
+    uint32_t pull_masks[4] = { 0 };
+    uint32_t i;
+
+    if (bcm2835_gpio_apply_fsels(inst, first, count, configs) != 0)
         return;
+
+    /* Merge the pulls into one read-modify-write per GPPUPPDN register */
+    for (i = 0; i < count; i++)
+    {
+        const struct bcm2835_slot *slot = &inst->pull_slots[first + i];
+        int pull_val = bcm2711_pull_code(configs[i].pull);
+
+        if (pull_val < 0)
+            continue;
+        pull_vals[slot->reg - GPPUPPDN0] |= (uint32_t)pull_val << slot->shift;
+        pull_masks[slot->reg - GPPUPPDN0] |= slot->mask;
     }
 
-    base[reg] = (base[reg] & ~(3 << lsb)) | (pull_val << lsb);
+    bcm2711_gpio_update_pulls(inst, pull_vals, pull_masks);
 }
 
 static const char *bcm2711_gpio_get_fsel_name(void *priv, unsigned gpio, GPIO_FSEL_T fsel)
@@ -426,6 +865,7 @@ static void *bcm2835_gpio_create_instance(const GPIO_CHIP_T *chip,
 {
     UNUSED(chip);
     UNUSED(dtnode);
+    bcm2835_build_slots(&bcm2835_instance);
     return &bcm2835_instance;
 }
 
@@ -458,16 +898,24 @@ static const GPIO_CHIP_INTERFACE_T bcm2835_gpio_interface =
     .gpio_set_pull = bcm2835_gpio_set_pull,
     .gpio_get_name = bcm2835_gpio_get_name,
     .gpio_get_fsel_name = bcm2835_gpio_get_fsel_name,
+    .gpio_get_state = bcm2835_gpio_get_state,
+    .gpio_get_levels = bcm2835_gpio_get_levels,
+    .gpio_update_drives = bcm2835_gpio_update_drives,
+    .gpio_get_drive_banks = bcm2835_gpio_get_drive_banks,
+    .gpio_apply_config = bcm2835_gpio_apply_config,
+    .gpio_set_pulls = bcm2835_gpio_set_pulls,
+    .gpio_set_fsels = bcm2835_gpio_set_fsels,
 };
 
 DECLARE_GPIO_CHIP(bcm2835, "brcm,bcm2835-gpio", &bcm2835_gpio_interface,
-                  0x30000, 0);
+                  0x100, 0);
 
 static void *bcm2711_gpio_create_instance(const GPIO_CHIP_T *chip,
                                           const char *dtnode)
 {
     UNUSED(chip);
     UNUSED(dtnode);
+    bcm2835_build_slots(&bcm2711_instance);
     return &bcm2711_instance;
 }
 
@@ -487,7 +935,14 @@ static const GPIO_CHIP_INTERFACE_T bcm2711_gpio_interface =
     .gpio_set_pull = bcm2711_gpio_set_pull,
     .gpio_get_name = bcm2835_gpio_get_name,
     .gpio_get_fsel_name = bcm2711_gpio_get_fsel_name,
+    .gpio_get_state = bcm2711_gpio_get_state,
+    .gpio_get_levels = bcm2835_gpio_get_levels,
+    .gpio_update_drives = bcm2835_gpio_update_drives,
+    .gpio_get_drive_banks = bcm2835_gpio_get_drive_banks,
+    .gpio_apply_config = bcm2711_gpio_apply_config,
+    .gpio_set_pulls = bcm2711_gpio_set_pulls,
+    .gpio_set_fsels = bcm2835_gpio_set_fsels,
 };
 
 DECLARE_GPIO_CHIP(bcm2711, "brcm,bcm2711-gpio",
-                  &bcm2711_gpio_interface, 0x30000, 0);
+                  &bcm2711_gpio_interface, 0x100, 0);
@@ -18,6 +18,11 @@
 
 #define IOCTL_MBOX_PROPERTY     _IOWR(MAJOR_NUM, 0, char *)
 
+#define FIRMWARE_MAX_WORDS      256     /* Of a property buffer */
+#if FIRMWARE_MOCK
+#define FIRMWARE_MOCK_LATENCY_US 200
+#endif
+
 #define RPI_FIRMWARE_STATUS_REQUEST  0
 #define RPI_FIRMWARE_STATUS_SUCCESS  0x80000000
 #define RPI_FIRMWARE_STATUS_ERROR    0x80000001
@@ -55,37 +60,162 @@ struct gpio_get_set_state
     uint32_t state;
 };
 
+struct firmware_tag
+{
+    uint32_t tag;
+    void *data;
+    int size;
+    int err;    /* Set by firmware_properties */
+};
+
 static struct firmware_inst firmware_instance;
 
-static int firmware_property(struct firmware_inst *inst, uint32_t tag, void *tag_data, int tag_size)
+#if FIRMWARE_MOCK
+/* The fake expander used off-target - see firmware_mock_property */
+static struct gpio_config firmware_mock_configs[NUM_GPIOS];
+static uint32_t firmware_mock_states[NUM_GPIOS];
+
+/* Answer a property buffer as the firmware would, after a delay typical of
+ * a VPU round trip so that the cost of each transaction shows up in
+ * gpiobench.
+ */
+static int firmware_mock_property(uint32_t *buf)
 {
-    uint32_t buf[16];
-    int words = 5 + (tag_size + 3) / 4 + 1;
+    unsigned words = buf[0] / sizeof(buf[0]);
+    unsigned pos = 2;
+
+    usleep(FIRMWARE_MOCK_LATENCY_US);
+
+    while (pos + 3 <= words && buf[pos] != RPI_FIRMWARE_PROPERTY_END)
+    {
+        uint32_t tag = buf[pos];
+        uint32_t size = buf[pos + 1];
+        uint32_t *data = &buf[pos + 3];
+        unsigned gpio = data[0] - RPI_EXP_GPIO_BASE;
+        struct gpio_config *config;
+        int ok = (gpio < NUM_GPIOS);
+
+        if (ok && (tag == RPI_FIRMWARE_GET_GPIO_STATE ||
+                   tag == RPI_FIRMWARE_SET_GPIO_STATE))
+            ok = (size >= sizeof(struct gpio_get_set_state));
+        else if (ok)
+            ok = (size >= sizeof(struct gpio_get_set_config));
+
+        if (ok)
+        {
+            config = &firmware_mock_configs[gpio];
+            switch (tag)
+            {
+            case RPI_FIRMWARE_GET_GPIO_STATE:
+                data[1] = firmware_mock_states[gpio];
+                break;
+            case RPI_FIRMWARE_SET_GPIO_STATE:
+                firmware_mock_states[gpio] = !!data[1];
+                break;
+            case RPI_FIRMWARE_GET_GPIO_CONFIG:
+                config->drive = firmware_mock_states[gpio];
+                memcpy(&data[1], config, sizeof(*config));
+                break;
+            case RPI_FIRMWARE_SET_GPIO_CONFIG:
+                memcpy(config, &data[1], sizeof(*config));
+                if (config->direction == 1)
+                    firmware_mock_states[gpio] = !!config->drive;
+                break;
+            default:
+                ok = 0;
+                break;
+            }
+        }
+
+        /* Unprocessed tags are left without the response bit */
+        if (ok)
+            buf[pos + 2] = RPI_FIRMWARE_STATUS_SUCCESS | size;
+        pos += 3 + (size + 3) / 4;
+    }
+
+    buf[1] = RPI_FIRMWARE_STATUS_SUCCESS;
+    return 0;
+}
+#endif
+
+/* Send any number of tags to the firmware in a single mailbox transaction.
+ * Returns 0 if the transaction succeeded, in which case the err field of
+ * each tag says whether that tag was processed.
+ */
+static int firmware_properties(struct firmware_inst *inst,
+                               struct firmware_tag *tags, unsigned num_tags)
+{
+    uint32_t buf[FIRMWARE_MAX_WORDS];
+    unsigned words = 2 + 1;
+    int mock = gpio_regs_simulated();
+    unsigned pos, i;
     int err;
 
-    if (words > (int)ARRAY_SIZE(buf))
-        return -1;
-    if (!inst->mbox_fd)
-        inst->mbox_fd = open(DEVICE_FILE_NAME, 0);
-    if (inst->mbox_fd < 0)
+    for (i = 0; i < num_tags; i++)
+        words += 3 + (tags[i].size + 3) / 4;
+    if (words > ARRAY_SIZE(buf))
         return -1;
+#if !FIRMWARE_MOCK
+    if (mock)
+        return -1; /* No mailbox to simulate */
+#endif
+    if (!mock)
+    {
+        if (!inst->mbox_fd)
+            inst->mbox_fd = open(DEVICE_FILE_NAME, 0);
+        if (inst->mbox_fd < 0)
+            return -1;
+    }
 
     buf[0] = words * sizeof(buf[0]);
     buf[1] = RPI_FIRMWARE_STATUS_REQUEST; // process request
-    buf[2] = tag;
-    buf[3] = tag_size;
-    buf[4] = tag_size; // set to response length
-    memcpy(&buf[5], tag_data, tag_size);
-    buf[words - 1] = RPI_FIRMWARE_PROPERTY_END;
-    err = ioctl(inst->mbox_fd, IOCTL_MBOX_PROPERTY, buf);
-    if (!err)
+    for (i = 0, pos = 2; i < num_tags; i++)
     {
-        if (buf[4] & RPI_FIRMWARE_STATUS_SUCCESS)
-            memcpy(tag_data, &buf[5], buf[4] & ~RPI_FIRMWARE_STATUS_SUCCESS);
+        buf[pos] = tags[i].tag;
+        buf[pos + 1] = tags[i].size;
+        buf[pos + 2] = tags[i].size; // set to response length
+        memcpy(&buf[pos + 3], tags[i].data, tags[i].size);
+        pos += 3 + (tags[i].size + 3) / 4;
+    }
+    buf[pos] = RPI_FIRMWARE_PROPERTY_END;
+
+#if FIRMWARE_MOCK
+    if (mock)
+        err = firmware_mock_property(buf);
+    else
+#endif
+        err = ioctl(inst->mbox_fd, IOCTL_MBOX_PROPERTY, buf);
+    if (err)
+        return err;
+
+    for (i = 0, pos = 2; i < num_tags; i++)
+    {
+        uint32_t len = buf[pos + 2];
+
+        tags[i].err = 0;
+        if (len & RPI_FIRMWARE_STATUS_SUCCESS)
+        {
+            len &= ~RPI_FIRMWARE_STATUS_SUCCESS;
+            if (len > (uint32_t)tags[i].size)
+                len = tags[i].size;
+            memcpy(tags[i].data, &buf[pos + 3], len);
+        }
         else
-            err = -EREMOTEIO;
+        {
+            tags[i].err = -EREMOTEIO;
+        }
+        pos += 3 + (tags[i].size + 3) / 4;
     }
-    return err;
+
+    return 0;
+}
+
+static int firmware_property(struct firmware_inst *inst, uint32_t tag, void *tag_data, int tag_size)
+{
+    struct firmware_tag prop = { tag, tag_data, tag_size, 0 };
+    int err = firmware_properties(inst, &prop, 1);
+
+    return err ? err : prop.err;
 }
 
 static int firmware_get_gpio_state(struct firmware_inst *inst, unsigned gpio)
@@ -105,17 +235,55 @@ static int firmware_set_gpio_state(struct firmware_inst *inst, unsigned gpio, un
     return firmware_property(inst, RPI_FIRMWARE_SET_GPIO_STATE, &prop, sizeof(prop));
 }
 
+/* Read the configs and states of count GPIOs in one transaction. Older
+ * firmware doesn't return the drive in the config, so the state is used
+ * instead. Returns the number of configs read, stopping at the first error.
+ */
+static unsigned firmware_get_gpio_configs(struct firmware_inst *inst, unsigned first,
+                                          unsigned count, struct gpio_config *configs,
+                                          int *levels)
+{
+    struct gpio_get_set_config config_props[NUM_GPIOS];
+    struct gpio_get_set_state state_props[NUM_GPIOS];
+    struct firmware_tag tags[NUM_GPIOS * 2];
+    unsigned i;
+
+    if (first >= inst->num_gpios || count > inst->num_gpios - first)
+        return 0;
+
+    for (i = 0; i < count; i++)
+    {
+        config_props[i].gpio = RPI_EXP_GPIO_BASE + first + i;
+        config_props[i].config.drive = ~0;
+        state_props[i].gpio = RPI_EXP_GPIO_BASE + first + i;
+        tags[i * 2] = (struct firmware_tag){ RPI_FIRMWARE_GET_GPIO_CONFIG,
+                                             &config_props[i], sizeof(config_props[i]), 0 };
+        tags[i * 2 + 1] = (struct firmware_tag){ RPI_FIRMWARE_GET_GPIO_STATE,
+                                                 &state_props[i], sizeof(state_props[i]), 0 };
+    }
+
+    if (firmware_properties(inst, tags, count * 2) != 0)
+        return 0;
+
+    for (i = 0; i < count; i++)
+    {
+        int level = tags[i * 2 + 1].err ? -1 : (int)state_props[i].state;
+
+        if (tags[i * 2].err)
+            break;
+        configs[i] = config_props[i].config;
+        if (configs[i].drive == ~0u)
+            configs[i].drive = level;
+        if (levels)
+            levels[i] = level;
+    }
+
+    return i;
+}
+
 static int firmware_get_gpio_config(struct firmware_inst *inst, int gpio, struct gpio_config *config)
 {
-    struct gpio_get_set_config prop;
-    prop.gpio = RPI_EXP_GPIO_BASE + gpio;
-    prop.config.drive = ~0;
-    if (firmware_property(inst, RPI_FIRMWARE_GET_GPIO_CONFIG, &prop, sizeof(prop)) < 0)
-        return -1;
-    if (prop.config.drive == ~0u)
-        prop.config.drive = firmware_get_gpio_state(inst, gpio);
-    *config = prop.config;
-    return 0;
+    return (firmware_get_gpio_configs(inst, gpio, 1, config, NULL) == 1) ? 0 : -1;
 }
 
 static int firmware_set_gpio_config(struct firmware_inst *inst, int gpio, const struct gpio_config *config)
@@ -261,6 +429,33 @@ static void firmware_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
     }
 }
 
+static void firmware_gpio_get_state(void *priv, uint32_t first, uint32_t count,
+                                    GPIO_PIN_STATE_T *states)
+{
+    struct firmware_inst *inst = priv;
+    struct gpio_config configs[NUM_GPIOS];
+    int levels[NUM_GPIOS];
+    unsigned num, i;
+
+    /* Every GPIO in a single round trip */
+    num = firmware_get_gpio_configs(inst, first, count, configs, levels);
+    for (i = 0; i < num; i++)
+    {
+        GPIO_PIN_STATE_T *state = &states[i];
+        struct gpio_config *config = &configs[i];
+
+        state->dir = (config->direction == 1) ? DIR_OUTPUT : DIR_INPUT;
+        state->fsel = (state->dir == DIR_OUTPUT) ? GPIO_FSEL_OUTPUT : GPIO_FSEL_INPUT;
+        if (state->dir == DIR_OUTPUT && config->drive != ~0u)
+            state->drive = config->drive ? DRIVE_HIGH : DRIVE_LOW;
+        if (!config->term_en)
+            state->pull = PULL_NONE;
+        else
+            state->pull = config->term_pull_up ? PULL_UP : PULL_DOWN;
+        state->level = levels[i];
+    }
+}
+
 static const char *firmware_gpio_get_name(void *priv, unsigned gpio)
 {
     struct firmware_inst *inst = priv;
@@ -317,6 +512,7 @@ static const GPIO_CHIP_INTERFACE_T firmware_gpio_interface =
     .gpio_set_pull = firmware_gpio_set_pull,
     .gpio_get_name = firmware_gpio_get_name,
     .gpio_get_fsel_name = firmware_gpio_get_fsel_name,
+    .gpio_get_state = firmware_gpio_get_state,
 };
 
 DECLARE_GPIO_CHIP(firmware, "raspberrypi,firmware-gpio", &firmware_gpio_interface,
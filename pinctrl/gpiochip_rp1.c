@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,11 +30,21 @@
 #define RP1_GPIO_CTRL_OUTOVER_MASK (0x03 << RP1_GPIO_CTRL_OUTOVER_LSB)
 #define RP1_GPIO_CTRL_OEOVER_LSB   14
 #define RP1_GPIO_CTRL_OEOVER_MASK  (0x03 << RP1_GPIO_CTRL_OEOVER_LSB)
+#define RP1_GPIO_CTRL_IRQRESET     (1 << 28)
+
+#define RP1_GPIO_STATUS_EDGE_LOW   (1 << 20)
+#define RP1_GPIO_STATUS_EDGE_HIGH  (1 << 21)
+#define RP1_GPIO_STATUS_EVENTS     (0xff << 20)
 
 #define RP1_PADS_OD_SET       (1 << 7)
 #define RP1_PADS_IE_SET       (1 << 6)
 #define RP1_PADS_PUE_SET      (1 << 3)
 #define RP1_PADS_PDE_SET      (1 << 2)
+#define RP1_PADS_DRIVE_LSB    4
+#define RP1_PADS_DRIVE_MASK   (0x03 << RP1_PADS_DRIVE_LSB)
+#define RP1_PADS_SCHMITT_SET  (1 << 1)
+#define RP1_PADS_SLEWFAST_SET (1 << 0)
+#define RP1_PADS_MASK         0xff
 
 #define RP1_GPIO_IO_REG_STATUS_OFFSET(offset) (((offset * 2) + 0) * sizeof(uint32_t))
 #define RP1_GPIO_IO_REG_CTRL_OFFSET(offset)   (((offset * 2) + 1) * sizeof(uint32_t))
@@ -43,11 +54,17 @@
 #define RP1_GPIO_SYS_RIO_REG_OE_OFFSET         0x4
 #define RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET    0x8
 
-#define rp1_gpio_write32(base, peri_offset, reg_offset, value) \
-    base[(peri_offset + reg_offset)/4] = value
+#define rp1_gpio_write32(inst, peri_offset, reg_offset, value) \
+    rp1_gpio_write_reg(inst, peri_offset, reg_offset, value)
+
+#define rp1_gpio_read32(inst, peri_offset, reg_offset) \
+    rp1_gpio_block(inst, peri_offset)[(reg_offset)/4]
 
-#define rp1_gpio_read32(base, peri_offset, reg_offset) \
-    base[(peri_offset + reg_offset)/4]
+struct rp1_inst
+{
+    volatile uint32_t *base;
+    int sim;
+};
 
 typedef struct
 {
@@ -79,6 +96,7 @@ static const GPIO_STATE_T gpio_state = {
 };
 
 static const int rp1_bank_base[] = {0, 28, 34};
+static pthread_mutex_t rp1_sim_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static const char *rp1_gpio_fsel_names[RP1_NUM_GPIOS][RP1_FSEL_COUNT] =
 {
@@ -138,6 +156,83 @@ static const char *rp1_gpio_fsel_names[RP1_NUM_GPIOS][RP1_FSEL_COUNT] =
     { "SPI8_CE1"  , "SPI7_CE0"     , 0              , "PCIE_CLKREQ_N", "VBUS_OC3"     , "SYS_RIO219", "PROC_RIO219", },
 };
 
+static volatile uint32_t *rp1_gpio_block(struct rp1_inst *inst,
+                                         uint32_t peri_offset)
+{
+    return inst->base + peri_offset / 4;
+}
+
+static unsigned rp1_gpio_bank_width(int bank);
+
+/* Register images are plain memory, so apply the aliases here, one write
+ * at a time so that they are as atomic as the hardware's.
+ */
+static void rp1_gpio_write_sim_reg(struct rp1_inst *inst, uint32_t peri_offset,
+                                   uint32_t reg_offset, uint32_t value)
+{
+    volatile uint32_t *block = rp1_gpio_block(inst, peri_offset);
+    uint32_t alias = reg_offset & 0x3000;
+    volatile uint32_t *reg;
+    uint32_t old;
+    int bank;
+
+    pthread_mutex_lock(&rp1_sim_lock);
+    reg = &block[(reg_offset - alias) / 4];
+    if (alias == RP1_XOR_OFFSET)
+        value ^= *reg;
+    else if (alias == RP1_SET_OFFSET)
+        value |= *reg;
+    else if (alias == RP1_CLR_OFFSET)
+        value = *reg & ~value;
+    for (bank = 0; bank < 3; bank++)
+    {
+        if (peri_offset == gpio_state.io[bank] &&
+            (reg_offset - alias) % 8 == 4 && (value & RP1_GPIO_CTRL_IRQRESET))
+        {
+            // IRQRESET clears the latched events and reads back as 0
+            value &= ~RP1_GPIO_CTRL_IRQRESET;
+            reg[-1] &= ~RP1_GPIO_STATUS_EVENTS;
+        }
+    }
+    old = *reg;
+    *reg = value;
+
+    // Loop the outputs back to the inputs, latching any edges
+    for (bank = 0; bank < 3; bank++)
+    {
+        if (peri_offset == gpio_state.sys_rio[bank] &&
+            reg_offset - alias == RP1_GPIO_SYS_RIO_REG_OUT_OFFSET)
+        {
+            volatile uint32_t *io = rp1_gpio_block(inst, gpio_state.io[bank]);
+            unsigned i;
+
+            reg[RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET / 4] = value;
+            for (i = 0; i < rp1_gpio_bank_width(bank); i++)
+            {
+                uint32_t bit = 1U << i;
+
+                if ((old ^ value) & bit)
+                    io[RP1_GPIO_IO_REG_STATUS_OFFSET(i) / 4] |=
+                        (value & bit) ? RP1_GPIO_STATUS_EDGE_HIGH :
+                                        RP1_GPIO_STATUS_EDGE_LOW;
+            }
+        }
+    }
+    pthread_mutex_unlock(&rp1_sim_lock);
+}
+
+/* Small enough to inline, leaving the hardware store in the caller and the
+ * emulation out of line.
+ */
+static void rp1_gpio_write_reg(struct rp1_inst *inst, uint32_t peri_offset,
+                               uint32_t reg_offset, uint32_t value)
+{
+    if (inst->sim)
+        rp1_gpio_write_sim_reg(inst, peri_offset, reg_offset, value);
+    else
+        rp1_gpio_block(inst, peri_offset)[reg_offset / 4] = value;
+}
+
 static void rp1_gpio_get_bank(int num, int *bank, int *offset)
 {
     *bank = *offset = 0;
@@ -157,146 +252,225 @@ static void rp1_gpio_get_bank(int num, int *bank, int *offset)
    *offset = num - rp1_bank_base[*bank];
 }
 
-static uint32_t rp1_gpio_ctrl_read(volatile uint32_t *base, int bank, int offset)
+static unsigned rp1_gpio_bank_width(int bank)
 {
-    return rp1_gpio_read32(base, gpio_state.io[bank], RP1_GPIO_IO_REG_CTRL_OFFSET(offset));
+    return ((bank < 2) ? rp1_bank_base[bank + 1] : RP1_NUM_GPIOS) - rp1_bank_base[bank];
 }
 
-static void rp1_gpio_ctrl_write(volatile uint32_t *base, int bank, int offset,
-                                uint32_t value)
+/* Convert a mask of GPIOs starting at first into a mask of bank bits */
+static uint32_t rp1_gpio_to_bank_mask(uint32_t first, uint32_t mask, int bank)
 {
-    rp1_gpio_write32(base, gpio_state.io[bank], RP1_GPIO_IO_REG_CTRL_OFFSET(offset), value);
+    int shift = rp1_bank_base[bank] - (int)first;
+
+    if (shift >= 32 || shift <= -32)
+        return 0;
+    mask = (shift >= 0) ? (mask >> shift) : (mask << -shift);
+    return mask & ((1U << rp1_gpio_bank_width(bank)) - 1);
+}
+
+/* The inverse of rp1_gpio_to_bank_mask */
+static uint32_t rp1_gpio_from_bank_mask(uint32_t first, uint32_t bank_mask, int bank)
+{
+    int shift = rp1_bank_base[bank] - (int)first;
+
+    if (shift >= 32 || shift <= -32)
+        return 0;
+    return (shift >= 0) ? (bank_mask << shift) : (bank_mask >> -shift);
+}
+
+static uint32_t rp1_gpio_ctrl_read(struct rp1_inst *inst, int bank, int offset)
+{
+    return rp1_gpio_read32(inst, gpio_state.io[bank], RP1_GPIO_IO_REG_CTRL_OFFSET(offset));
+}
+
+/* Toggle the bits of a control register that differ from value, within
+ * mask, using the atomic XOR alias so that other fields are untouched. The
+ * difference is only right if the field doesn't change between the read
+ * and the write, hence the lock.
+ */
+static void rp1_gpio_ctrl_update(struct rp1_inst *inst, int bank, int offset,
+                                 uint32_t mask, uint32_t value)
+{
+    volatile uint32_t *reg = &rp1_gpio_block(inst, gpio_state.io[bank])
+        [RP1_GPIO_IO_REG_CTRL_OFFSET(offset) / 4];
+    uint32_t diff;
+
+    gpio_reg_lock(reg);
+    diff = (*reg ^ value) & mask;
+    if (diff)
+        rp1_gpio_write32(inst, gpio_state.io[bank],
+                         RP1_GPIO_IO_REG_CTRL_OFFSET(offset) + RP1_XOR_OFFSET, diff);
+    gpio_reg_unlock(reg);
 }
 
-static uint32_t rp1_gpio_pads_read(volatile uint32_t *base, int bank, int offset)
+static uint32_t rp1_gpio_pads_read(struct rp1_inst *inst, int bank, int offset)
 {
-    return rp1_gpio_read32(base, gpio_state.pads[bank], RP1_GPIO_PADS_REG_OFFSET(offset));
+    return rp1_gpio_read32(inst, gpio_state.pads[bank], RP1_GPIO_PADS_REG_OFFSET(offset));
 }
 
-static void rp1_gpio_pads_write(volatile uint32_t *base, int bank, int offset,
-                                uint32_t value)
+/* As rp1_gpio_ctrl_update, for a pads register */
+static void rp1_gpio_pads_update(struct rp1_inst *inst, int bank, int offset,
+                                 uint32_t mask, uint32_t value)
 {
-    rp1_gpio_write32(base, gpio_state.pads[bank], RP1_GPIO_PADS_REG_OFFSET(offset), value);
+    volatile uint32_t *reg = &rp1_gpio_block(inst, gpio_state.pads[bank])
+        [RP1_GPIO_PADS_REG_OFFSET(offset) / 4];
+    uint32_t diff;
+
+    gpio_reg_lock(reg);
+    diff = (*reg ^ value) & mask;
+    if (diff)
+        rp1_gpio_write32(inst, gpio_state.pads[bank],
+                         RP1_GPIO_PADS_REG_OFFSET(offset) + RP1_XOR_OFFSET, diff);
+    gpio_reg_unlock(reg);
 }
 
-static uint32_t rp1_gpio_sys_rio_out_read(volatile uint32_t *base, int bank,
+static uint32_t rp1_gpio_sys_rio_out_read(struct rp1_inst *inst, int bank,
                                           int offset)
 {
     UNUSED(offset);
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank], RP1_GPIO_SYS_RIO_REG_OUT_OFFSET);
+    return rp1_gpio_read32(inst, gpio_state.sys_rio[bank], RP1_GPIO_SYS_RIO_REG_OUT_OFFSET);
 }
 
-static uint32_t rp1_gpio_sys_rio_sync_in_read(volatile uint32_t *base, int bank,
+static uint32_t rp1_gpio_sys_rio_sync_in_read(struct rp1_inst *inst, int bank,
                                               int offset)
 {
     UNUSED(offset);
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank],
+    return rp1_gpio_read32(inst, gpio_state.sys_rio[bank],
                            RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET);
 }
 
-static void rp1_gpio_sys_rio_out_set(volatile uint32_t *base, int bank, int offset)
+static void rp1_gpio_sys_rio_out_set(struct rp1_inst *inst, int bank, int offset)
 {
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
+    rp1_gpio_write32(inst, gpio_state.sys_rio[bank],
                      RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_SET_OFFSET, 1U << offset);
 }
 
-static void rp1_gpio_sys_rio_out_clr(volatile uint32_t *base, int bank, int offset)
+static void rp1_gpio_sys_rio_out_clr(struct rp1_inst *inst, int bank, int offset)
 {
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
+    rp1_gpio_write32(inst, gpio_state.sys_rio[bank],
                      RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_CLR_OFFSET, 1U << offset);
 }
 
-static uint32_t rp1_gpio_sys_rio_oe_read(volatile uint32_t *base, int bank)
+static void rp1_gpio_sys_rio_out_update(struct rp1_inst *inst, int bank,
+                                        uint32_t alias, uint32_t mask)
+{
+    rp1_gpio_write32(inst, gpio_state.sys_rio[bank],
+                     RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + alias, mask);
+}
+
+static uint32_t rp1_gpio_sys_rio_oe_read(struct rp1_inst *inst, int bank)
 {
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank],
+    return rp1_gpio_read32(inst, gpio_state.sys_rio[bank],
                            RP1_GPIO_SYS_RIO_REG_OE_OFFSET);
 }
 
-static void rp1_gpio_sys_rio_oe_clr(volatile uint32_t *base, int bank, int offset)
+static void rp1_gpio_sys_rio_oe_clr(struct rp1_inst *inst, int bank, int offset)
 {
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
+    rp1_gpio_write32(inst, gpio_state.sys_rio[bank],
                      RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_CLR_OFFSET,
                      1U << offset);
 }
 
-static void rp1_gpio_sys_rio_oe_set(volatile uint32_t *base, int bank, int offset)
+static void rp1_gpio_sys_rio_oe_set(struct rp1_inst *inst, int bank, int offset)
 {
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
+    rp1_gpio_write32(inst, gpio_state.sys_rio[bank],
                      RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_SET_OFFSET,
                      1U << offset);
 }
 
 static void rp1_gpio_set_dir(void *priv, uint32_t gpio, GPIO_DIR_T dir)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     int bank, offset;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
 
     if (dir == DIR_INPUT)
-        rp1_gpio_sys_rio_oe_clr(base, bank, offset);
+        rp1_gpio_sys_rio_oe_clr(inst, bank, offset);
     else if (dir == DIR_OUTPUT)
-        rp1_gpio_sys_rio_oe_set(base, bank, offset);
+        rp1_gpio_sys_rio_oe_set(inst, bank, offset);
     else
         assert(0);
 }
 
 static GPIO_DIR_T rp1_gpio_get_dir(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     int bank, offset;
     GPIO_DIR_T dir;
     uint32_t reg;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_sys_rio_oe_read(base, bank);
+    reg = rp1_gpio_sys_rio_oe_read(inst, bank);
 
     dir = (reg & (1U << offset)) ? DIR_OUTPUT : DIR_INPUT;
 
     return dir;
 }
 
-static GPIO_FSEL_T rp1_gpio_get_fsel(void *priv, unsigned gpio)
+static GPIO_FSEL_T rp1_gpio_ctrl_to_fsel(uint32_t ctrl_reg)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
-    uint32_t reg;
-    GPIO_FSEL_T fsel;
     RP1_FSEL_T rsel;
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_ctrl_read(base, bank, offset);
-    rsel = ((reg & RP1_GPIO_CTRL_FSEL_MASK) >> RP1_GPIO_CTRL_FSEL_LSB);
+    rsel = ((ctrl_reg & RP1_GPIO_CTRL_FSEL_MASK) >> RP1_GPIO_CTRL_FSEL_LSB);
     if (rsel == RP1_FSEL_SYS_RIO)
-        fsel = GPIO_FSEL_GPIO;
+        return GPIO_FSEL_GPIO;
     else if (rsel == RP1_FSEL_NULL)
-        fsel = GPIO_FSEL_NONE;
+        return GPIO_FSEL_NONE;
     else if (rsel < RP1_FSEL_COUNT)
-        fsel = (GPIO_FSEL_T)rsel;
+        return (GPIO_FSEL_T)rsel;
     else
-        fsel = GPIO_FSEL_MAX;
+        return GPIO_FSEL_MAX;
+}
 
-    return fsel;
+static GPIO_PULL_T rp1_gpio_pads_to_pull(uint32_t pad_reg)
+{
+    if (pad_reg & RP1_PADS_PUE_SET)
+        return PULL_UP;
+    else if (pad_reg & RP1_PADS_PDE_SET)
+        return PULL_DOWN;
+    return PULL_NONE;
 }
 
-static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
+static GPIO_FSEL_T rp1_gpio_get_fsel(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     int bank, offset;
-    uint32_t ctrl_reg;
-    uint32_t pad_reg;
-    uint32_t old_pad_reg;
-    RP1_FSEL_T rsel;
 
+    rp1_gpio_get_bank(gpio, &bank, &offset);
+    return rp1_gpio_ctrl_to_fsel(rp1_gpio_ctrl_read(inst, bank, offset));
+}
+
+/* The funcsel for a function, or -1 if there isn't one */
+static int rp1_gpio_fsel_to_rsel(GPIO_FSEL_T func)
+{
     if (func < (GPIO_FSEL_T)RP1_FSEL_COUNT)
-        rsel = (RP1_FSEL_T)func;
+        return (RP1_FSEL_T)func;
     else if (func == GPIO_FSEL_INPUT ||
              func == GPIO_FSEL_OUTPUT ||
              func == GPIO_FSEL_GPIO)
-        rsel = RP1_FSEL_SYS_RIO;
+        return RP1_FSEL_SYS_RIO;
     else if (func == GPIO_FSEL_NONE)
-        rsel = RP1_FSEL_NULL;
+        return RP1_FSEL_NULL;
     else
+        return -1;
+}
+
+/* The pads enables to go with a funcsel */
+static uint32_t rp1_gpio_pads_for_rsel(uint32_t pad_reg, int rsel)
+{
+    if (rsel == RP1_FSEL_NULL)
+        return (pad_reg & ~RP1_PADS_IE_SET) | RP1_PADS_OD_SET;
+    return (pad_reg | RP1_PADS_IE_SET) & ~RP1_PADS_OD_SET;
+}
+
+static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
+{
+    struct rp1_inst *inst = priv;
+    int bank, offset;
+    int rsel = rp1_gpio_fsel_to_rsel(func);
+
+    if (rsel < 0)
         return;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
@@ -305,112 +479,423 @@ static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
     else if (func == GPIO_FSEL_OUTPUT)
         rp1_gpio_set_dir(priv, gpio, DIR_OUTPUT);
 
-    ctrl_reg = rp1_gpio_ctrl_read(base, bank, offset) & ~RP1_GPIO_CTRL_FSEL_MASK;
-    ctrl_reg |= rsel << RP1_GPIO_CTRL_FSEL_LSB;
-    rp1_gpio_ctrl_write(base, bank, offset, ctrl_reg);
-
-    pad_reg = rp1_gpio_pads_read(base, bank, offset);
-    old_pad_reg = pad_reg;
-    if (rsel == RP1_FSEL_NULL)
-    {
-        // Disable input
-        pad_reg &= ~RP1_PADS_IE_SET;
-    }
-    else
-    {
-        // Enable input
-        pad_reg |= RP1_PADS_IE_SET;
-    }
+    // All updates go through the alias windows, so never disturb other fields
+    rp1_gpio_ctrl_update(inst, bank, offset, RP1_GPIO_CTRL_FSEL_MASK,
+                         rsel << RP1_GPIO_CTRL_FSEL_LSB);
 
-    if (rsel != RP1_FSEL_NULL)
-    {
-        // Enable peripheral func output
-        pad_reg &= ~RP1_PADS_OD_SET;
-    }
-    else
-    {
-        // Disable peripheral func output
-        pad_reg |= RP1_PADS_OD_SET;
-    }
-
-    if (pad_reg != old_pad_reg)
-        rp1_gpio_pads_write(base, bank, offset, pad_reg);
+    // Disable (or enable) input and peripheral func output in one write
+    rp1_gpio_pads_update(inst, bank, offset,
+                         RP1_PADS_IE_SET | RP1_PADS_OD_SET,
+                         (rsel == RP1_FSEL_NULL) ? RP1_PADS_OD_SET : RP1_PADS_IE_SET);
 }
 
 static int rp1_gpio_get_level(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     int bank, offset;
     uint32_t pad_reg;
     uint32_t reg;
     int level;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
-    pad_reg = rp1_gpio_pads_read(base, bank, offset);
+    pad_reg = rp1_gpio_pads_read(inst, bank, offset);
     if (!(pad_reg & RP1_PADS_IE_SET))
 	return -1;
-    reg = rp1_gpio_sys_rio_sync_in_read(base, bank, offset);
+    reg = rp1_gpio_sys_rio_sync_in_read(inst, bank, offset);
     level = (reg & (1U << offset)) ? 1 : 0;
 
     return level;
 }
 
+static int rp1_gpio_get_levels(void *priv, uint32_t first, uint32_t mask,
+                               uint32_t *levels)
+{
+    struct rp1_inst *inst = priv;
+    int bank;
+
+    *levels = 0;
+    for (bank = 0; bank < 3; bank++)
+    {
+        uint32_t bank_mask = rp1_gpio_to_bank_mask(first, mask, bank);
+        uint32_t reg;
+
+        if (!bank_mask)
+            continue;
+        reg = rp1_gpio_sys_rio_sync_in_read(inst, bank, 0);
+        *levels |= rp1_gpio_from_bank_mask(first, reg & bank_mask, bank);
+    }
+
+    return 0;
+}
+
+/* The edge detectors latch in each GPIO's STATUS register whether or not
+ * the interrupt is enabled, and IRQRESET clears them. There is no atomic
+ * read-and-clear, so an edge latched between the two is lost.
+ */
+static int rp1_gpio_get_edges(void *priv, uint32_t first, uint32_t mask,
+                              uint32_t *rising, uint32_t *falling)
+{
+    struct rp1_inst *inst = priv;
+    int bank;
+
+    *rising = *falling = 0;
+    for (bank = 0; bank < 3; bank++)
+    {
+        uint32_t bank_mask = rp1_gpio_to_bank_mask(first, mask, bank);
+        uint32_t rise = 0, fall = 0;
+        int offset;
+
+        for (offset = 0; bank_mask; offset++, bank_mask >>= 1)
+        {
+            uint32_t status;
+
+            if (!(bank_mask & 1))
+                continue;
+            status = rp1_gpio_read32(inst, gpio_state.io[bank],
+                                     RP1_GPIO_IO_REG_STATUS_OFFSET(offset));
+            if (!(status & (RP1_GPIO_STATUS_EDGE_HIGH | RP1_GPIO_STATUS_EDGE_LOW)))
+                continue;
+            if (status & RP1_GPIO_STATUS_EDGE_HIGH)
+                rise |= 1U << offset;
+            if (status & RP1_GPIO_STATUS_EDGE_LOW)
+                fall |= 1U << offset;
+            rp1_gpio_write32(inst, gpio_state.io[bank],
+                             RP1_SET_OFFSET + RP1_GPIO_IO_REG_CTRL_OFFSET(offset),
+                             RP1_GPIO_CTRL_IRQRESET);
+        }
+        *rising |= rp1_gpio_from_bank_mask(first, rise, bank);
+        *falling |= rp1_gpio_from_bank_mask(first, fall, bank);
+    }
+
+    return 0;
+}
+
 static void rp1_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     int bank, offset;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
     if (drv == DRIVE_HIGH)
-        rp1_gpio_sys_rio_out_set(base, bank, offset);
+        rp1_gpio_sys_rio_out_set(inst, bank, offset);
     else if (drv == DRIVE_LOW)
-        rp1_gpio_sys_rio_out_clr(base, bank, offset);
+        rp1_gpio_sys_rio_out_clr(inst, bank, offset);
+}
+
+static void rp1_gpio_update_drives(void *priv, uint32_t first, uint32_t set_mask,
+                                   uint32_t clr_mask, uint32_t xor_mask)
+{
+    struct rp1_inst *inst = priv;
+    int bank;
+
+    /* Use the atomic alias windows - one store per bank */
+    for (bank = 0; bank < 3; bank++)
+    {
+        uint32_t set = rp1_gpio_to_bank_mask(first, set_mask, bank);
+        uint32_t clr = rp1_gpio_to_bank_mask(first, clr_mask, bank);
+        uint32_t xor = rp1_gpio_to_bank_mask(first, xor_mask, bank);
+
+        if (set && !clr && !xor)
+            rp1_gpio_sys_rio_out_update(inst, bank, RP1_SET_OFFSET, set);
+        else if (clr && !set && !xor)
+            rp1_gpio_sys_rio_out_update(inst, bank, RP1_CLR_OFFSET, clr);
+        else if (set || clr || xor)
+        {
+            // Change all the outputs together by flipping just those that differ
+            uint32_t out = rp1_gpio_sys_rio_out_read(inst, bank, 0);
+
+            xor ^= (set & ~out) | (clr & out);
+            if (xor)
+                rp1_gpio_sys_rio_out_update(inst, bank, RP1_XOR_OFFSET, xor);
+        }
+    }
+}
+
+static int rp1_gpio_get_drive_banks(void *priv, uint32_t first,
+                                    GPIO_DRIVE_BANK_T *banks)
+{
+    struct rp1_inst *inst = priv;
+    int count = 0, bank;
+
+    /* Simulated aliases have to go through rp1_gpio_write_sim_reg */
+    if (inst->sim || first >= RP1_NUM_GPIOS)
+        return -1;
+
+    for (bank = 0; bank < 3; bank++)
+    {
+        uint32_t bank_mask = rp1_gpio_to_bank_mask(first, ~0U, bank);
+        volatile uint32_t *out;
+
+        if (!bank_mask)
+            continue;
+        out = rp1_gpio_block(inst, gpio_state.sys_rio[bank]) +
+              RP1_GPIO_SYS_RIO_REG_OUT_OFFSET / 4;
+        banks[count].set = out + RP1_SET_OFFSET / 4;
+        banks[count].clr = out + RP1_CLR_OFFSET / 4;
+        banks[count].mask = rp1_gpio_from_bank_mask(first, bank_mask, bank);
+        banks[count].shift = (int)first - rp1_bank_base[bank];
+        count++;
+    }
+
+    return count;
 }
 
 static void rp1_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
 {
-    volatile uint32_t *base = priv;
-    uint32_t reg;
+    struct rp1_inst *inst = priv;
+    uint32_t reg = 0;
     int bank, offset;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_pads_read(base, bank, offset);
-    reg &= ~(RP1_PADS_PDE_SET | RP1_PADS_PUE_SET);
     if (pull == PULL_UP)
-        reg |= RP1_PADS_PUE_SET;
+        reg = RP1_PADS_PUE_SET;
     else if (pull == PULL_DOWN)
-        reg |= RP1_PADS_PDE_SET;
-    rp1_gpio_pads_write(base, bank, offset, reg);
+        reg = RP1_PADS_PDE_SET;
+    rp1_gpio_pads_update(inst, bank, offset,
+                         RP1_PADS_PDE_SET | RP1_PADS_PUE_SET, reg);
 }
 
 static GPIO_PULL_T rp1_gpio_get_pull(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
+    int bank, offset;
+
+    rp1_gpio_get_bank(gpio, &bank, &offset);
+    return rp1_gpio_pads_to_pull(rp1_gpio_pads_read(inst, bank, offset));
+}
+
+static int rp1_gpio_get_pad_ctrl(void *priv, unsigned gpio, GPIO_PAD_CTRL_T *ctrl)
+{
+    struct rp1_inst *inst = priv;
     uint32_t reg;
-    GPIO_PULL_T pull = PULL_NONE;
     int bank, offset;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_pads_read(base, bank, offset);
-    if (reg & RP1_PADS_PUE_SET)
-        pull = PULL_UP;
-    else if (reg & RP1_PADS_PDE_SET)
-        pull = PULL_DOWN;
+    reg = rp1_gpio_pads_read(inst, bank, offset);
+    ctrl->strength = (reg & RP1_PADS_DRIVE_MASK) >> RP1_PADS_DRIVE_LSB;
+    ctrl->slew = (reg & RP1_PADS_SLEWFAST_SET) ? SLEW_FAST : SLEW_SLOW;
+    ctrl->schmitt = (reg & RP1_PADS_SCHMITT_SET) ? SCHMITT_ON : SCHMITT_OFF;
+    return 0;
+}
+
+static void rp1_gpio_set_pad_ctrl(void *priv, unsigned gpio,
+                                  const GPIO_PAD_CTRL_T *ctrl)
+{
+    struct rp1_inst *inst = priv;
+    uint32_t mask = 0, value = 0;
+    int bank, offset;
+
+    // GPIO_STRENGTH_T matches the encoding of the DRIVE field
+    if (ctrl->strength < STRENGTH_MAX)
+    {
+        mask |= RP1_PADS_DRIVE_MASK;
+        value |= ctrl->strength << RP1_PADS_DRIVE_LSB;
+    }
+    if (ctrl->slew < SLEW_MAX)
+    {
+        mask |= RP1_PADS_SLEWFAST_SET;
+        value |= (ctrl->slew == SLEW_FAST) ? RP1_PADS_SLEWFAST_SET : 0;
+    }
+    if (ctrl->schmitt < SCHMITT_MAX)
+    {
+        mask |= RP1_PADS_SCHMITT_SET;
+        value |= (ctrl->schmitt == SCHMITT_ON) ? RP1_PADS_SCHMITT_SET : 0;
+    }
+
+    rp1_gpio_get_bank(gpio, &bank, &offset);
+    rp1_gpio_pads_update(inst, bank, offset, mask, value);
+}
 
-    return pull;
+static void rp1_gpio_set_pad_ctrls(void *priv, uint32_t first, uint32_t mask,
+                                   const GPIO_PAD_CTRL_T *ctrl)
+{
+    int i;
+
+    // Each pad has its own register, so there is nothing to share
+    for (i = 0; i < 32; i++)
+    {
+        if (mask & (1U << i))
+            rp1_gpio_set_pad_ctrl(priv, first + i, ctrl);
+    }
 }
 
 static GPIO_DRIVE_T rp1_gpio_get_drive(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
+    struct rp1_inst *inst = priv;
     uint32_t reg;
     int bank, offset;
 
     rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_sys_rio_out_read(base, bank, offset);
+    reg = rp1_gpio_sys_rio_out_read(inst, bank, offset);
     return (reg & (1U << offset)) ? DRIVE_HIGH : DRIVE_LOW;
 }
 
+static int rp1_gpio_get_pad(void *priv, unsigned gpio)
+{
+    struct rp1_inst *inst = priv;
+    int bank, offset;
+
+    rp1_gpio_get_bank(gpio, &bank, &offset);
+    return rp1_gpio_pads_read(inst, bank, offset) & RP1_PADS_MASK;
+}
+
+static void rp1_gpio_set_pad(void *priv, unsigned gpio, uint32_t pad)
+{
+    struct rp1_inst *inst = priv;
+    int bank, offset;
+
+    rp1_gpio_get_bank(gpio, &bank, &offset);
+    rp1_gpio_pads_update(inst, bank, offset, RP1_PADS_MASK, pad);
+}
+
+static void rp1_gpio_get_state(void *priv, uint32_t first, uint32_t count,
+                               GPIO_PIN_STATE_T *states)
+{
+    struct rp1_inst *inst = priv;
+    uint32_t oe = 0, out = 0, sync_in = 0;
+    int cur_bank = -1;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_PIN_STATE_T *state = &states[i];
+        uint32_t pad_reg;
+        int bank, offset;
+
+        rp1_gpio_get_bank(first + i, &bank, &offset);
+        if (bank != cur_bank)
+        {
+            // The sys_rio registers cover the whole bank
+            oe = rp1_gpio_sys_rio_oe_read(inst, bank);
+            out = rp1_gpio_sys_rio_out_read(inst, bank, offset);
+            sync_in = rp1_gpio_sys_rio_sync_in_read(inst, bank, offset);
+            cur_bank = bank;
+        }
+
+        pad_reg = rp1_gpio_pads_read(inst, bank, offset);
+        state->fsel = rp1_gpio_ctrl_to_fsel(rp1_gpio_ctrl_read(inst, bank, offset));
+        state->dir = (oe & (1U << offset)) ? DIR_OUTPUT : DIR_INPUT;
+        state->drive = (out & (1U << offset)) ? DRIVE_HIGH : DRIVE_LOW;
+        state->pull = rp1_gpio_pads_to_pull(pad_reg);
+        if (pad_reg & RP1_PADS_IE_SET)
+            state->level = (sync_in & (1U << offset)) ? 1 : 0;
+        else
+            state->level = -1;
+    }
+}
+
+/* Change a register from old to val with a single store, through whichever
+ * alias leaves the other bits alone.
+ */
+static void rp1_gpio_write_diff(struct rp1_inst *inst, uint32_t peri_offset,
+                                uint32_t reg_offset, uint32_t old, uint32_t val)
+{
+    uint32_t diff = old ^ val;
+    uint32_t alias;
+
+    if (!diff)
+        return;
+    if (!(diff & old))
+        alias = RP1_SET_OFFSET;
+    else if (!(diff & val))
+        alias = RP1_CLR_OFFSET;
+    else
+        alias = RP1_XOR_OFFSET;
+    rp1_gpio_write32(inst, peri_offset, reg_offset + alias, diff);
+}
+
+static void rp1_gpio_apply_config(void *priv, uint32_t first, uint32_t count,
+                                  const GPIO_PIN_CONFIG_T *configs)
+{
+    struct rp1_inst *inst = priv;
+    uint32_t oe[3], out[3], new_oe[3], new_out[3];
+    int bank_read[3] = { 0 };
+    uint32_t i;
+    int bank, offset;
+
+    if (first >= RP1_NUM_GPIOS || count > RP1_NUM_GPIOS - first)
+        return;
+
+    // Work out the final sys_rio words of each bank
+    for (i = 0; i < count; i++)
+    {
+        const GPIO_PIN_CONFIG_T *config = &configs[i];
+        GPIO_DIR_T dir = config->dir;
+        uint32_t bit;
+
+        if (config->fsel == GPIO_FSEL_INPUT)
+            dir = DIR_INPUT;
+        else if (config->fsel == GPIO_FSEL_OUTPUT)
+            dir = DIR_OUTPUT;
+        if (dir >= DIR_MAX && config->drive >= DRIVE_MAX)
+            continue;
+
+        rp1_gpio_get_bank(first + i, &bank, &offset);
+        bit = 1U << offset;
+        if (!bank_read[bank])
+        {
+            oe[bank] = new_oe[bank] = rp1_gpio_sys_rio_oe_read(inst, bank);
+            out[bank] = new_out[bank] = rp1_gpio_sys_rio_out_read(inst, bank, 0);
+            bank_read[bank] = 1;
+        }
+        if (dir == DIR_OUTPUT)
+            new_oe[bank] |= bit;
+        else if (dir == DIR_INPUT)
+            new_oe[bank] &= ~bit;
+        if (config->drive == DRIVE_HIGH)
+            new_out[bank] |= bit;
+        else if (config->drive == DRIVE_LOW)
+            new_out[bank] &= ~bit;
+    }
+
+    // The levels go first, so that new outputs start at the right level
+    for (bank = 0; bank < 3; bank++)
+    {
+        if (!bank_read[bank])
+            continue;
+        rp1_gpio_write_diff(inst, gpio_state.sys_rio[bank],
+                            RP1_GPIO_SYS_RIO_REG_OUT_OFFSET, out[bank], new_out[bank]);
+        rp1_gpio_write_diff(inst, gpio_state.sys_rio[bank],
+                            RP1_GPIO_SYS_RIO_REG_OE_OFFSET, oe[bank], new_oe[bank]);
+    }
+
+    // Then the ctrl and pads registers of each GPIO, at most once each
+    for (i = 0; i < count; i++)
+    {
+        const GPIO_PIN_CONFIG_T *config = &configs[i];
+        uint32_t mask = 0, val = 0;
+        int rsel = -1;
+
+        if (config->fsel < GPIO_FSEL_MAX)
+            rsel = rp1_gpio_fsel_to_rsel(config->fsel);
+        if (rsel < 0 && config->pull >= PULL_MAX && config->pad < 0)
+            continue;
+
+        rp1_gpio_get_bank(first + i, &bank, &offset);
+        if (rsel >= 0)
+        {
+            rp1_gpio_ctrl_update(inst, bank, offset, RP1_GPIO_CTRL_FSEL_MASK,
+                                 rsel << RP1_GPIO_CTRL_FSEL_LSB);
+            mask |= RP1_PADS_IE_SET | RP1_PADS_OD_SET;
+            val |= rp1_gpio_pads_for_rsel(0, rsel);
+        }
+        if (config->pull < PULL_MAX)
+        {
+            mask |= RP1_PADS_PUE_SET | RP1_PADS_PDE_SET;
+            if (config->pull == PULL_UP)
+                val |= RP1_PADS_PUE_SET;
+            else if (config->pull == PULL_DOWN)
+                val |= RP1_PADS_PDE_SET;
+        }
+        if (config->pad >= 0)
+        {
+            mask = RP1_PADS_MASK;
+            val = (uint32_t)config->pad & RP1_PADS_MASK;
+        }
+        rp1_gpio_pads_update(inst, bank, offset, mask, val);
+    }
+}
+
 static const char *rp1_gpio_get_name(void *priv, unsigned gpio)
 {
     static char name_buf[16];
@@ -478,8 +963,15 @@ static int rp1_gpio_count(void *priv)
 
 static void *rp1_gpio_probe_instance(void *priv, volatile uint32_t *base)
 {
+    struct rp1_inst *inst;
+
     UNUSED(priv);
-    return (void *)base;
+    inst = calloc(1, sizeof(*inst));
+    if (!inst)
+        return NULL;
+    inst->base = base;
+    inst->sim = gpio_regs_simulated();
+    return inst;
 }
 
 static const GPIO_CHIP_INTERFACE_T rp1_gpio_interface =
@@ -498,6 +990,17 @@ static const GPIO_CHIP_INTERFACE_T rp1_gpio_interface =
     .gpio_set_pull = rp1_gpio_set_pull,
     .gpio_get_name = rp1_gpio_get_name,
     .gpio_get_fsel_name = rp1_gpio_get_fsel_name,
+    .gpio_get_state = rp1_gpio_get_state,
+    .gpio_get_levels = rp1_gpio_get_levels,
+    .gpio_get_edges = rp1_gpio_get_edges,
+    .gpio_update_drives = rp1_gpio_update_drives,
+    .gpio_get_drive_banks = rp1_gpio_get_drive_banks,
+    .gpio_get_pad = rp1_gpio_get_pad,
+    .gpio_set_pad = rp1_gpio_set_pad,
+    .gpio_apply_config = rp1_gpio_apply_config,
+    .gpio_get_pad_ctrl = rp1_gpio_get_pad_ctrl,
+    .gpio_set_pad_ctrl = rp1_gpio_set_pad_ctrl,
+    .gpio_set_pad_ctrls = rp1_gpio_set_pad_ctrls,
 };
 
 DECLARE_GPIO_CHIP(rp1, "raspberrypi,rp1-gpio",
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gpioclient.h"
+#include "gpioserver.h"
+
+struct GPIO_CLIENT_
+{
+    int fd;
+    GPIO_RESPONSE_T rsp;
+};
+
+GPIO_CLIENT_T *gpio_client_open(const char *path)
+{
+    struct sockaddr_un addr;
+    GPIO_CLIENT_T *client;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return NULL;
+    strcpy(addr.sun_path, path);
+
+    client = malloc(sizeof(*client));
+    if (!client)
+        return NULL;
+
+    client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (client->fd < 0 ||
+        connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        if (client->fd >= 0)
+            close(client->fd);
+        free(client);
+        return NULL;
+    }
+
+    return client;
+}
+
+void gpio_client_close(GPIO_CLIENT_T *client)
+{
+    if (!client)
+        return;
+    close(client->fd);
+    free(client);
+}
+
+static int gpio_client_request(GPIO_CLIENT_T *client, GPIO_REQUEST_OP_T op,
+                               unsigned gpio, unsigned count, uint32_t value,
+                               uint32_t mask)
+{
+    GPIO_REQUEST_T req;
+    ssize_t len;
+
+    memset(&req, 0, sizeof(req));
+    req.version = GPIO_SERVER_VERSION;
+    req.op = (uint8_t)op;
+    req.count = (uint16_t)count;
+    req.gpio = gpio;
+    req.value = value;
+    req.mask = mask;
+
+    do
+        len = send(client->fd, &req, sizeof(req), MSG_NOSIGNAL);
+    while (len < 0 && errno == EINTR);
+    if (len != (ssize_t)sizeof(req))
+        return -1;
+
+    do
+        len = recv(client->fd, &client->rsp, sizeof(client->rsp), 0);
+    while (len < 0 && errno == EINTR);
+    if (len < (ssize_t)GPIO_RESPONSE_SIZE(0) ||
+        client->rsp.count > GPIO_SERVER_MAX_STATES ||
+        len != (ssize_t)GPIO_RESPONSE_SIZE(client->rsp.count))
+        return -1;
+
+    return client->rsp.status;
+}
+
+int gpio_client_snapshot(GPIO_CLIENT_T *client, unsigned first, unsigned count,
+                         GPIO_PIN_STATE_T *states)
+{
+    /* Split large ranges into as many requests as necessary */
+    while (count)
+    {
+        unsigned chunk = count;
+
+        if (chunk > GPIO_SERVER_MAX_STATES)
+            chunk = GPIO_SERVER_MAX_STATES;
+        if (gpio_client_request(client, GPIO_REQ_SNAPSHOT, first, chunk, 0, 0) != 0)
+            return -1;
+        memcpy(states, client->rsp.states, chunk * sizeof(*states));
+        states += chunk;
+        first += chunk;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+int gpio_client_set_fsel(GPIO_CLIENT_T *client, unsigned gpio, GPIO_FSEL_T func)
+{
+    return gpio_client_request(client, GPIO_REQ_SET_FSEL, gpio, 0, func, 0);
+}
+
+int gpio_client_set_dir(GPIO_CLIENT_T *client, unsigned gpio, GPIO_DIR_T dir)
+{
+    return gpio_client_request(client, GPIO_REQ_SET_DIR, gpio, 0, dir, 0);
+}
+
+int gpio_client_set_drive(GPIO_CLIENT_T *client, unsigned gpio, GPIO_DRIVE_T drv)
+{
+    return gpio_client_request(client, GPIO_REQ_SET_DRIVE, gpio, 0, drv, 0);
+}
+
+int gpio_client_set_pull(GPIO_CLIENT_T *client, unsigned gpio, GPIO_PULL_T pull)
+{
+    return gpio_client_request(client, GPIO_REQ_SET_PULL, gpio, 0, pull, 0);
+}
+
+int gpio_client_get_levels(GPIO_CLIENT_T *client, unsigned gpio_base,
+                           uint32_t mask, uint32_t *levels)
+{
+    if (gpio_client_request(client, GPIO_REQ_GET_LEVELS, gpio_base, 0, 0, mask) != 0)
+        return -1;
+    *levels = client->rsp.value;
+    return 0;
+}
+
+int gpio_client_set_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask)
+{
+    return gpio_client_request(client, GPIO_REQ_SET_MASK, gpio_base, 0, 0, mask);
+}
+
+int gpio_client_clear_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask)
+{
+    return gpio_client_request(client, GPIO_REQ_CLEAR_MASK, gpio_base, 0, 0, mask);
+}
+
+int gpio_client_toggle_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask)
+{
+    return gpio_client_request(client, GPIO_REQ_TOGGLE_MASK, gpio_base, 0, 0, mask);
+}
@@ -0,0 +1,25 @@
+#ifndef GPIOCLIENT_H
+#define GPIOCLIENT_H
+
+#include <stdint.h>
+
+#include "gpiolib.h"
+
+typedef struct GPIO_CLIENT_ GPIO_CLIENT_T;
+
+GPIO_CLIENT_T *gpio_client_open(const char *path);
+void gpio_client_close(GPIO_CLIENT_T *client);
+
+int gpio_client_snapshot(GPIO_CLIENT_T *client, unsigned first, unsigned count,
+                         GPIO_PIN_STATE_T *states);
+int gpio_client_set_fsel(GPIO_CLIENT_T *client, unsigned gpio, GPIO_FSEL_T func);
+int gpio_client_set_dir(GPIO_CLIENT_T *client, unsigned gpio, GPIO_DIR_T dir);
+int gpio_client_set_drive(GPIO_CLIENT_T *client, unsigned gpio, GPIO_DRIVE_T drv);
+int gpio_client_set_pull(GPIO_CLIENT_T *client, unsigned gpio, GPIO_PULL_T pull);
+int gpio_client_get_levels(GPIO_CLIENT_T *client, unsigned gpio_base,
+                           uint32_t mask, uint32_t *levels);
+int gpio_client_set_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask);
+int gpio_client_clear_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask);
+int gpio_client_toggle_mask(GPIO_CLIENT_T *client, unsigned gpio_base, uint32_t mask);
+
+#endif
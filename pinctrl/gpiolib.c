@@ -4,16 +4,40 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gpiochip.h"
 #include "util.h"
 
 #define MAX_GPIO_CHIPS 8
+#define MAX_CHIP_BANKS 8
+#define NUM_REG_LOCKS  64
+
+#define GPIO_CACHE_MAGIC   0x43495047 /* "GPIC" */
+#define GPIO_CACHE_VERSION 3
+#define GPIO_CACHE_KEY_LEN 64
+
+/* What gpiolib last read from, or wrote to, one GPIO (see gpiolib_set_shadow) */
+typedef struct GPIO_SHADOW_
+{
+    uint8_t fsel;   /* As the chip reports it, so possibly GPIO_FSEL_GPIO */
+    uint8_t dir;
+    uint8_t drive;
+    uint8_t pull;
+    int32_t pad;    /* Or -1 */
+    uint8_t stale;  /* Written since last read, so re-read before use */
+} GPIO_SHADOW_T;
 
 typedef struct GPIO_CHIP_INSTANCE_
 {
@@ -21,14 +45,34 @@ typedef struct GPIO_CHIP_INSTANCE_
     const char *name;
     const char *dtnode;
     int mem_fd;
+    char *mem_path;
+    char *chardev;          /* Space-separated, one per kernel gpiochip of the node */
+    int num_banks;          /* Of chardev, or -1 until gpio_get_chardev needs them */
+    char *bank_chardevs[MAX_CHIP_BANKS];
+    unsigned bank_bases[MAX_CHIP_BANKS];
     void *priv;
     uint64_t phys_addr;
     unsigned num_gpios;
     uint32_t base;
+    uint8_t map_state;
+    int map_fd;             /* gpiomem, /dev/mem or sim image */
+    off_t map_offset;       /* File offset of the start of the window */
+    unsigned map_align;     /* Offset of the registers within the window */
+    char *map_base;         /* Mapped window */
+    GPIO_SHADOW_T *shadow;  /* One per GPIO, or NULL */
 } GPIO_CHIP_INSTANCE_T;
 
+enum
+{
+    MAP_NONE,               /* gpiolib_mmap not called (or nothing to map) */
+    MAP_PENDING,            /* Opened, to be mapped on first use */
+    MAP_DONE,
+    MAP_FAILED_STATE,
+};
+
 static unsigned num_gpio_chips;
 static GPIO_CHIP_INSTANCE_T gpio_chips[MAX_GPIO_CHIPS];
+static uint8_t gpio_chip_map[MAX_GPIO_PINS]; /* Chip index + 1, or 0 */
 
 static unsigned num_gpios;
 static unsigned first_hdr_pin = GPIO_INVALID;
@@ -36,8 +80,68 @@ static unsigned last_hdr_pin = GPIO_INVALID;
 static const char *gpio_names[MAX_GPIO_PINS];
 static unsigned hdr_gpios[NUM_HDR_PINS + 1];
 
+typedef struct
+{
+    const char *name;   /* Points into gpio_names[gpio] - not terminated */
+    uint16_t len;
+    uint16_t gpio;
+} GPIO_NAME_ENTRY_T;
+
+static GPIO_NAME_ENTRY_T *name_index;
+static unsigned name_index_mask;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    char key[GPIO_CACHE_KEY_LEN];
+    uint32_t num_chips;
+    uint32_t num_gpios;
+    uint32_t first_hdr_pin;
+    uint32_t last_hdr_pin;
+    uint32_t hdr_gpios[NUM_HDR_PINS + 1];
+} GPIO_CACHE_HEADER_T;
+
+// Followed by the chip name, dtnode, gpiomem path and chardev list as strings
+typedef struct
+{
+    uint64_t phys_addr;
+    uint32_t base;
+    uint32_t num_gpios;
+} GPIO_CACHE_CHIP_T;
+
+/* The GPIOs of a group which fit in one 32-bit window of one chip, with
+ * tables to scatter each byte of a group value into the window's bits and
+ * to gather each byte of the window back into group bits.
+ */
+typedef struct
+{
+    unsigned gpio_base;
+    uint32_t mask;
+    uint32_t scatter[4][256];
+    uint32_t gather[4][256];
+} GPIO_GROUP_SEGMENT_T;
+
+struct GPIO_GROUP_
+{
+    unsigned num_lanes;
+    unsigned num_segments;
+    GPIO_GROUP_SEGMENT_T segments[];
+};
+
+static const char *cache_path;
+static int thread_safe;
+static int shadow_enabled;
+static int gpios_mmapped;
+static atomic_uint reg_locks[NUM_REG_LOCKS];
+static const char *dtb_path;
+static int dt_offline;
+static const char *sim_dir;
+static int dev_mem_fd = -1;
+
 const char *pull_names[] = { "pn", "pd", "pu", "--" };
 const char *drive_names[] = { "dl", "dh", "--" };
+const char *strength_names[] = { "ds2", "ds4", "ds8", "ds12", "--" };
 const char *fsel_names[] =
 {
     "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
@@ -75,7 +179,13 @@ static GPIO_CHIP_INSTANCE_T *gpio_create_instance(const GPIO_CHIP_T *chip,
     inst->dtnode = dtnode;
     inst->phys_addr = phys_addr;
     inst->priv = NULL;
+    inst->mem_path = NULL;
+    inst->chardev = NULL;
+    inst->num_banks = -1;
     inst->base = 0;
+    inst->mem_fd = -1;
+    inst->map_state = MAP_NONE;
+    inst->shadow = NULL;
 
     inst->priv = chip->interface->gpio_create_instance(chip, dtnode);
     if (!inst->priv)
@@ -86,26 +196,254 @@ static GPIO_CHIP_INSTANCE_T *gpio_create_instance(const GPIO_CHIP_T *chip,
     return inst;
 }
 
-static int gpio_get_interface(unsigned gpio,
-                              const GPIO_CHIP_INTERFACE_T **iface_ptr,
-                              void **priv, unsigned *offset)
+static GPIO_CHIP_INSTANCE_T *gpio_find_instance(const char *dtnode)
 {
     unsigned i;
 
-    *iface_ptr = NULL;
     for (i = 0; i < num_gpio_chips; i++)
     {
-        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
-        const GPIO_CHIP_T *chip = inst->chip;
-        if (gpio >= inst->base && gpio < (inst->base + inst->num_gpios))
+        if (gpio_chips[i].dtnode && !strcmp(gpio_chips[i].dtnode, dtnode))
+            return &gpio_chips[i];
+    }
+    return NULL;
+}
+
+static void gpio_map_instance(GPIO_CHIP_INSTANCE_T *inst)
+{
+    unsigned gpio;
+
+    for (gpio = 0; gpio < inst->num_gpios; gpio++)
+        gpio_chip_map[inst->base + gpio] = (uint8_t)(inst - gpio_chips + 1);
+}
+
+static GPIO_CHIP_INSTANCE_T *gpio_get_instance(unsigned gpio)
+{
+    if (gpio >= MAX_GPIO_PINS || !gpio_chip_map[gpio])
+        return NULL;
+    return &gpio_chips[gpio_chip_map[gpio] - 1];
+}
+
+static int gpio_map_chip(GPIO_CHIP_INSTANCE_T *inst);
+
+/* Read the state of some GPIOs of a chip into its shadow. Anything the chip
+ * can't report (e.g. the drives and pulls of a BCM2835) is left as it was
+ * last written.
+ */
+static void gpio_shadow_read(GPIO_CHIP_INSTANCE_T *inst, unsigned offset,
+                             unsigned count)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = inst->chip->interface;
+    GPIO_PIN_STATE_T states[MAX_GPIO_PINS];
+    unsigned i;
+
+    // Chips only fill in what they have
+    for (i = 0; i < count; i++)
+    {
+        states[i].fsel = GPIO_FSEL_MAX;
+        states[i].dir = DIR_MAX;
+        states[i].drive = DRIVE_MAX;
+        states[i].pull = PULL_MAX;
+        states[i].level = -1;
+    }
+    if (iface->gpio_get_state)
+        iface->gpio_get_state(inst->priv, offset, count, states);
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_SHADOW_T *shadow = &inst->shadow[offset + i];
+        GPIO_PIN_STATE_T *state = &states[i];
+
+        if (!gpio_names[inst->base + offset + i])
+            continue;
+        if (!iface->gpio_get_state)
         {
-            *iface_ptr = chip->interface;
-            *priv = inst->priv;
-            *offset = gpio - inst->base;
-            return 0;
+            state->fsel = iface->gpio_get_fsel(inst->priv, offset + i);
+            state->dir = iface->gpio_get_dir(inst->priv, offset + i);
+            state->drive = iface->gpio_get_drive(inst->priv, offset + i);
+            state->pull = iface->gpio_get_pull(inst->priv, offset + i);
         }
+
+        if (state->fsel != GPIO_FSEL_MAX)
+            shadow->fsel = state->fsel;
+        if (state->dir != DIR_MAX)
+            shadow->dir = state->dir;
+        if (state->drive != DRIVE_MAX)
+            shadow->drive = state->drive;
+        if (state->pull != PULL_MAX)
+            shadow->pull = state->pull;
+        if (iface->gpio_get_pad)
+            shadow->pad = iface->gpio_get_pad(inst->priv, offset + i);
+        shadow->stale = 0;
+    }
+}
+
+static void gpio_shadow_create(GPIO_CHIP_INSTANCE_T *inst)
+{
+    unsigned i;
+
+    // Without a shadow everything is read from the hardware, so carry on
+    inst->shadow = malloc(inst->num_gpios * sizeof(GPIO_SHADOW_T));
+    if (!inst->shadow)
+        return;
+
+    for (i = 0; i < inst->num_gpios; i++)
+    {
+        GPIO_SHADOW_T *shadow = &inst->shadow[i];
+
+        shadow->fsel = GPIO_FSEL_MAX;
+        shadow->dir = DIR_MAX;
+        shadow->drive = DRIVE_MAX;
+        shadow->pull = PULL_MAX;
+        shadow->pad = -1;
+        shadow->stale = 0;
+    }
+    gpio_shadow_read(inst, 0, inst->num_gpios);
+}
+
+/* Map a chip, and any that share its backend state (e.g. the BCM2712 gpio
+ * and pinctrl blocks, which are used together), on first use.
+ */
+static void gpio_map_chip_group(GPIO_CHIP_INSTANCE_T *inst)
+{
+    unsigned i;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *other = &gpio_chips[i];
+
+        if (other != inst && other->map_state == MAP_PENDING &&
+            other->priv == inst->priv)
+            gpio_map_chip(other);
+    }
+    gpio_map_chip(inst);
+}
+
+/* Map the chip and create its shadow on first use. In thread-safe mode
+ * every chip has already been mapped and there is no shadow, so this only
+ * reads.
+ */
+static int gpio_chip_ready(GPIO_CHIP_INSTANCE_T *inst)
+{
+    if (inst->map_state == MAP_PENDING)
+        gpio_map_chip_group(inst);
+    if (inst->map_state == MAP_FAILED_STATE)
+        return -1;
+    if (shadow_enabled && !thread_safe && gpios_mmapped && !inst->shadow)
+        gpio_shadow_create(inst);
+    return 0;
+}
+
+static int gpio_get_interface(unsigned gpio,
+                              const GPIO_CHIP_INTERFACE_T **iface_ptr,
+                              void **priv, unsigned *offset)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio);
+
+    *iface_ptr = NULL;
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return -1;
+
+    *iface_ptr = inst->chip->interface;
+    *priv = inst->priv;
+    *offset = gpio - inst->base;
+    return 0;
+}
+
+/* The shadow of a GPIO, to be updated after writing to it */
+static GPIO_SHADOW_T *gpio_shadow_entry(unsigned gpio)
+{
+    GPIO_CHIP_INSTANCE_T *inst;
+
+    if (!shadow_enabled)
+        return NULL;
+    inst = gpio_get_instance(gpio);
+    if (!inst || gpio_chip_ready(inst) != 0 || !inst->shadow)
+        return NULL;
+    return &inst->shadow[gpio - inst->base];
+}
+
+/* The shadow of a GPIO, brought up to date to be read from */
+static GPIO_SHADOW_T *gpio_get_shadow(unsigned gpio)
+{
+    GPIO_SHADOW_T *shadow = gpio_shadow_entry(gpio);
+
+    if (shadow && shadow->stale)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio);
+
+        gpio_shadow_read(inst, gpio - inst->base, 1);
+    }
+    return shadow;
+}
+
+/* Record the settings of a configuration, leaving the rest to be re-read */
+static void gpio_shadow_record(GPIO_SHADOW_T *shadow, const GPIO_PIN_CONFIG_T *config)
+{
+    if (config->fsel < GPIO_FSEL_MAX)
+        shadow->fsel = config->fsel;
+    if (config->dir < DIR_MAX)
+        shadow->dir = config->dir;
+    if (config->drive < DRIVE_MAX)
+        shadow->drive = config->drive;
+    if (config->pull < PULL_MAX)
+        shadow->pull = config->pull;
+    if (config->pad >= 0)
+        shadow->pad = config->pad;
+
+    // Changing the drive alone can't have side effects
+    if (config->fsel < GPIO_FSEL_MAX || config->dir < DIR_MAX ||
+        config->pull < PULL_MAX || config->pad >= 0)
+        shadow->stale = 1;
+}
+
+static void gpio_shadow_set(unsigned gpio, GPIO_FSEL_T fsel, GPIO_DIR_T dir,
+                            GPIO_DRIVE_T drive, GPIO_PULL_T pull)
+{
+    GPIO_SHADOW_T *shadow = gpio_shadow_entry(gpio);
+    GPIO_PIN_CONFIG_T config = { fsel, dir, drive, pull, -1 };
+
+    if (shadow)
+        gpio_shadow_record(shadow, &config);
+}
+
+int gpio_get_handle(unsigned gpio, GPIO_HANDLE_T *handle)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio);
+
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return -1;
+
+    handle->iface = inst->chip->interface;
+    handle->priv = inst->priv;
+    handle->offset = gpio - inst->base;
+    handle->shadow = &inst->shadow;
+    return 0;
+}
+
+int gpio_handle_get_level(const GPIO_HANDLE_T *handle)
+{
+    return handle->iface->gpio_get_level(handle->priv, handle->offset);
+}
+
+void gpio_handle_set_drive(const GPIO_HANDLE_T *handle, GPIO_DRIVE_T drv)
+{
+    GPIO_SHADOW_T *shadow = *handle->shadow;
+
+    handle->iface->gpio_set_drive(handle->priv, handle->offset, drv);
+    if (shadow && drv < DRIVE_MAX)
+        shadow[handle->offset].drive = drv;
+}
+
+void gpio_handle_set_dir(const GPIO_HANDLE_T *handle, GPIO_DIR_T dir)
+{
+    GPIO_SHADOW_T *shadow = *handle->shadow;
+
+    handle->iface->gpio_set_dir(handle->priv, handle->offset, dir);
+    if (shadow && dir < DIR_MAX)
+    {
+        shadow[handle->offset].dir = dir;
+        shadow[handle->offset].stale = 1;
     }
-    return -1;
 }
 
 int gpio_num_is_valid(unsigned gpio)
@@ -116,9 +454,12 @@ int gpio_num_is_valid(unsigned gpio)
 GPIO_DIR_T gpio_get_dir(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_SHADOW_T *shadow = gpio_get_shadow(gpio);
     unsigned gpio_offset;
     void *priv;
 
+    if (shadow)
+        return shadow->dir;
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
         return iface->gpio_get_dir(priv, gpio_offset);
     return DIR_MAX;
@@ -131,17 +472,23 @@ void gpio_set_dir(unsigned gpio, GPIO_DIR_T dir)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+    {
         iface->gpio_set_dir(priv, gpio_offset, dir);
+        gpio_shadow_set(gpio, GPIO_FSEL_MAX, dir, DRIVE_MAX, PULL_MAX);
+    }
 }
 
 GPIO_FSEL_T gpio_get_fsel(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_SHADOW_T *shadow = gpio_get_shadow(gpio);
     GPIO_FSEL_T fsel = GPIO_FSEL_MAX;
     unsigned gpio_offset;
     void *priv;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+    if (shadow)
+        fsel = shadow->fsel;
+    else if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
         fsel = iface->gpio_get_fsel(priv, gpio_offset);
 
     if (fsel == GPIO_FSEL_GPIO)
@@ -162,7 +509,47 @@ void gpio_set_fsel(unsigned gpio, const GPIO_FSEL_T func)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+    {
         iface->gpio_set_fsel(priv, gpio_offset, func);
+        gpio_shadow_set(gpio, func, DIR_MAX, DRIVE_MAX, PULL_MAX);
+    }
+}
+
+void gpio_set_fsel_mask(unsigned gpio_base, uint32_t mask, GPIO_FSEL_T func)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    int i;
+
+    if (!inst || func >= GPIO_FSEL_MAX || gpio_chip_ready(inst) != 0)
+        return;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    // Ignore any GPIOs beyond the end of the chip
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    if (iface->gpio_set_fsels)
+    {
+        iface->gpio_set_fsels(inst->priv, offset, mask, func);
+    }
+    else
+    {
+        for (i = 0; i < 32; i++)
+        {
+            if (mask & (1U << i))
+                iface->gpio_set_fsel(inst->priv, offset + i, func);
+        }
+    }
+
+    for (i = 0; inst->shadow && i < 32; i++)
+    {
+        if (mask & (1U << i))
+            gpio_shadow_set(gpio_base + i, func, DIR_MAX, DRIVE_MAX, PULL_MAX);
+    }
 }
 
 void gpio_set_drive(unsigned gpio, GPIO_DRIVE_T drv)
@@ -172,7 +559,10 @@ void gpio_set_drive(unsigned gpio, GPIO_DRIVE_T drv)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+    {
         iface->gpio_set_drive(priv, gpio_offset, drv);
+        gpio_shadow_set(gpio, GPIO_FSEL_MAX, DIR_MAX, drv, PULL_MAX);
+    }
 }
 
 void gpio_set(unsigned gpio)
@@ -185,6 +575,7 @@ void gpio_set(unsigned gpio)
     {
         iface->gpio_set_drive(priv, gpio_offset, 1);
         iface->gpio_set_dir(priv, gpio_offset, DIR_OUTPUT);
+        gpio_shadow_set(gpio, GPIO_FSEL_MAX, DIR_OUTPUT, DRIVE_HIGH, PULL_MAX);
     }
 }
 
@@ -198,133 +589,1090 @@ void gpio_clear(unsigned gpio)
     {
         iface->gpio_set_drive(priv, gpio_offset, 0);
         iface->gpio_set_dir(priv, gpio_offset, DIR_OUTPUT);
+        gpio_shadow_set(gpio, GPIO_FSEL_MAX, DIR_OUTPUT, DRIVE_LOW, PULL_MAX);
     }
 }
 
-int gpio_get_level(unsigned gpio)
+/* Turn toggles of drives the shadow knows into sets and clears, and record
+ * the results.
+ */
+static void gpio_shadow_update_drives(GPIO_SHADOW_T *shadow, uint32_t *set_mask,
+                                      uint32_t *clr_mask, uint32_t *xor_mask)
 {
-    const GPIO_CHIP_INTERFACE_T *iface = NULL;
-    unsigned gpio_offset;
-    void *priv;
+    uint32_t bits = *set_mask | *clr_mask | *xor_mask;
+    int i;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_level(priv, gpio_offset);
-    return 0;
+    for (i = 0; i < 32; i++)
+    {
+        uint32_t bit = 1U << i;
+
+        if (!(bits & bit))
+            continue;
+        if (*xor_mask & bit)
+        {
+            if (shadow[i].drive == DRIVE_MAX)
+                continue;
+            *xor_mask &= ~bit;
+            if (shadow[i].drive == DRIVE_HIGH)
+                *clr_mask |= bit;
+            else
+                *set_mask |= bit;
+        }
+        shadow[i].drive = (*set_mask & bit) ? DRIVE_HIGH : DRIVE_LOW;
+    }
 }
 
-GPIO_DRIVE_T gpio_get_drive(unsigned gpio)
+static void gpio_update_drives(unsigned gpio_base, uint32_t set_mask,
+                               uint32_t clr_mask, uint32_t xor_mask)
 {
-    const GPIO_CHIP_INTERFACE_T *iface = NULL;
-    unsigned gpio_offset;
-    void *priv;
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    uint32_t valid;
+    int i;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_drive(priv, gpio_offset);
-    return DRIVE_MAX;
-}
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return;
 
-GPIO_PULL_T gpio_get_pull(unsigned gpio)
-{
-    const GPIO_CHIP_INTERFACE_T *iface = NULL;
-    unsigned gpio_offset;
-    void *priv;
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_pull(priv, gpio_offset);
-    return PULL_MAX;
-}
+    // Ignore any GPIOs beyond the end of the chip
+    valid = ~0U;
+    if (inst->num_gpios - offset < 32)
+        valid = (1U << (inst->num_gpios - offset)) - 1;
+    set_mask &= valid;
+    clr_mask &= valid & ~set_mask;
+    xor_mask &= valid & ~(set_mask | clr_mask);
 
-void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull)
-{
-    const GPIO_CHIP_INTERFACE_T *iface = NULL;
-    unsigned gpio_offset;
-    void *priv;
+    if (inst->shadow)
+        gpio_shadow_update_drives(&inst->shadow[offset], &set_mask,
+                                  &clr_mask, &xor_mask);
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        iface->gpio_set_pull(priv, gpio_offset, pull);
-}
+    if (iface->gpio_update_drives)
+    {
+        iface->gpio_update_drives(inst->priv, offset, set_mask, clr_mask,
+                                  xor_mask);
+        return;
+    }
 
-void gpio_get_pin_range(unsigned *first, unsigned *last)
-{
-    if (first_hdr_pin == GPIO_INVALID)
+    for (i = 0; i < 32; i++)
     {
-        unsigned i;
+        uint32_t bit = 1U << i;
+        GPIO_DRIVE_T drv;
 
-        for (i = 0; i < num_gpio_chips; i++)
+        if (!(valid & bit))
+            break;
+        if (set_mask & bit)
+            drv = DRIVE_HIGH;
+        else if (clr_mask & bit)
+            drv = DRIVE_LOW;
+        else if (xor_mask & bit)
+            drv = iface->gpio_get_drive(inst->priv, offset + i);
+        else
+            continue;
+        if (xor_mask & bit)
         {
-            if (!strncmp(gpio_chips[i].name, "bcm2", 4) ||
-                !strcmp(gpio_chips[i].name, "rp1"))
-            {
-                // Assume it's the standard RPi 40-pin header layout
-                uint32_t base = gpio_chips[i].base;
-
-                hdr_gpios[3] = base + 2;
-                hdr_gpios[5] = base + 3;
-                hdr_gpios[7] = base + 4;
-                hdr_gpios[8] = base + 14;
-                hdr_gpios[10] = base + 15;
-                hdr_gpios[11] = base + 17;
-                hdr_gpios[12] = base + 18;
-                hdr_gpios[13] = base + 27;
-                hdr_gpios[15] = base + 22;
-                hdr_gpios[16] = base + 23;
-                hdr_gpios[18] = base + 24;
-                hdr_gpios[19] = base + 10;
-                hdr_gpios[21] = base + 9;
-                hdr_gpios[18] = base + 24;
-                hdr_gpios[22] = base + 25;
-                hdr_gpios[23] = base + 11;
-                hdr_gpios[24] = base + 8;
-                hdr_gpios[26] = base + 7;
-                hdr_gpios[27] = base + 0;
-                hdr_gpios[28] = base + 1;
-                hdr_gpios[29] = base + 5;
-                hdr_gpios[31] = base + 6;
-                hdr_gpios[32] = base + 12;
-                hdr_gpios[33] = base + 13;
-                hdr_gpios[35] = base + 19;
-                hdr_gpios[36] = base + 16;
-                hdr_gpios[37] = base + 26;
-                hdr_gpios[38] = base + 20;
-                hdr_gpios[40] = base + 21;
-
-                first_hdr_pin = 1;
-                last_hdr_pin = 40;
-                break;
-            }
+            if (drv == DRIVE_MAX)
+                continue;
+            drv = (drv == DRIVE_HIGH) ? DRIVE_LOW : DRIVE_HIGH;
         }
+        iface->gpio_set_drive(inst->priv, offset + i, drv);
     }
-    if (first)
-        *first = first_hdr_pin;
-    if (last)
-        *last = last_hdr_pin;
 }
 
-unsigned gpio_for_pin(int pin)
+void gpio_set_mask(unsigned gpio_base, uint32_t mask)
 {
-    if (pin >= 1 && pin <= NUM_HDR_PINS)
-        return hdr_gpios[pin];
-    return GPIO_INVALID;
+    gpio_update_drives(gpio_base, mask, 0, 0);
 }
 
-int gpio_to_pin(unsigned gpio)
+void gpio_clear_mask(unsigned gpio_base, uint32_t mask)
 {
-    int i;
+    gpio_update_drives(gpio_base, 0, mask, 0);
+}
 
-    for (i = 1; i <= NUM_HDR_PINS; i++)
-    {
+void gpio_toggle_mask(unsigned gpio_base, uint32_t mask)
+{
+    gpio_update_drives(gpio_base, 0, 0, mask);
+}
+
+GPIO_GROUP_T *gpio_group_create(const unsigned *gpios, unsigned count)
+{
+    unsigned sorted[32], seg_bases[32];
+    GPIO_GROUP_T *group;
+    unsigned num_segments = 0;
+    unsigned i, j, s;
+
+    if (!count || count > 32)
+        return NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned gpio = gpios[i];
+
+        if (!gpio_num_is_valid(gpio))
+            return NULL;
+
+        // Insertion sort, rejecting duplicates
+        for (j = i; j > 0 && sorted[j - 1] >= gpio; j--)
+        {
+            if (sorted[j - 1] == gpio)
+                return NULL;
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = gpio;
+    }
+
+    // Split into windows of up to 32 GPIOs on the same chip
+    for (i = 0; i < count; i++)
+    {
+        if (!num_segments ||
+            sorted[i] >= seg_bases[num_segments - 1] + 32 ||
+            gpio_get_instance(sorted[i]) != gpio_get_instance(seg_bases[num_segments - 1]))
+            seg_bases[num_segments++] = sorted[i];
+    }
+
+    group = calloc(1, sizeof(*group) + num_segments * sizeof(group->segments[0]));
+    if (!group)
+        return NULL;
+    group->num_lanes = (count + 7) / 8;
+    group->num_segments = num_segments;
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_GROUP_SEGMENT_T *seg;
+        unsigned bit, b;
+
+        for (s = num_segments - 1; gpios[i] < seg_bases[s]; s--)
+            continue;
+        seg = &group->segments[s];
+        seg->gpio_base = seg_bases[s];
+        bit = gpios[i] - seg->gpio_base;
+        seg->mask |= 1U << bit;
+
+        for (b = 0; b < 256; b++)
+        {
+            if (b & (1U << (i % 8)))
+                seg->scatter[i / 8][b] |= 1U << bit;
+            if (b & (1U << (bit % 8)))
+                seg->gather[bit / 8][b] |= 1U << i;
+        }
+    }
+
+    return group;
+}
+
+void gpio_group_write(GPIO_GROUP_T *group, uint32_t value)
+{
+    unsigned s, lane;
+
+    for (s = 0; s < group->num_segments; s++)
+    {
+        const GPIO_GROUP_SEGMENT_T *seg = &group->segments[s];
+        uint32_t bits = 0;
+
+        for (lane = 0; lane < group->num_lanes; lane++)
+            bits |= seg->scatter[lane][(value >> (lane * 8)) & 0xff];
+        gpio_update_drives(seg->gpio_base, bits, seg->mask & ~bits, 0);
+    }
+}
+
+static uint32_t gpio_group_scatter(const GPIO_GROUP_T *group,
+                                   const GPIO_GROUP_SEGMENT_T *seg, uint32_t value)
+{
+    uint32_t bits = 0;
+    unsigned lane;
+
+    for (lane = 0; lane < group->num_lanes; lane++)
+        bits |= seg->scatter[lane][(value >> (lane * 8)) & 0xff];
+    return bits;
+}
+
+void gpio_group_update(GPIO_GROUP_T *group, uint32_t set_mask, uint32_t clr_mask)
+{
+    unsigned s;
+
+    for (s = 0; s < group->num_segments; s++)
+    {
+        const GPIO_GROUP_SEGMENT_T *seg = &group->segments[s];
+        uint32_t set_bits = gpio_group_scatter(group, seg, set_mask);
+        uint32_t clr_bits = gpio_group_scatter(group, seg, clr_mask);
+
+        if (set_bits | clr_bits)
+            gpio_update_drives(seg->gpio_base, set_bits, clr_bits, 0);
+    }
+}
+
+uint32_t gpio_group_read(GPIO_GROUP_T *group)
+{
+    uint32_t value = 0;
+    unsigned s, lane;
+
+    for (s = 0; s < group->num_segments; s++)
+    {
+        const GPIO_GROUP_SEGMENT_T *seg = &group->segments[s];
+        uint32_t levels;
+
+        if (gpio_get_levels(seg->gpio_base, seg->mask, &levels) != 0)
+            continue;
+        for (lane = 0; lane < 4; lane++)
+        {
+            if ((seg->mask >> (lane * 8)) & 0xff)
+                value |= seg->gather[lane][(levels >> (lane * 8)) & 0xff];
+        }
+    }
+
+    return value;
+}
+
+void gpio_group_free(GPIO_GROUP_T *group)
+{
+    free(group);
+}
+
+/* Sleep until this long before each deadline, then spin, to cover the
+ * wake-up latency of the thread.
+ */
+#define GPIO_WAVE_SPIN_NS 100000
+
+/* A group segment resolved before playback, so that a step only has to
+ * store to the chip's set and clear registers.
+ */
+typedef struct
+{
+    const GPIO_GROUP_SEGMENT_T *seg;
+    const GPIO_CHIP_INTERFACE_T *iface;  /* NULL to use gpio_update_drives */
+    void *priv;
+    unsigned offset;
+    int num_banks;  /* < 0 to use iface->gpio_update_drives */
+    GPIO_DRIVE_BANK_T banks[GPIO_MAX_DRIVE_BANKS];
+} GPIO_WAVE_SEGMENT_T;
+
+typedef struct
+{
+    GPIO_GROUP_T *group;
+    GPIO_WAVE_SEGMENT_T *segments;
+    const GPIO_WAVE_STEP_T *steps;
+    unsigned num_steps;
+    unsigned repeat;
+    uint32_t *errors;
+} GPIO_WAVE_T;
+
+static uint64_t gpio_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void gpio_wave_resolve(const GPIO_GROUP_SEGMENT_T *seg,
+                              GPIO_WAVE_SEGMENT_T *ws)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(seg->gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+
+    ws->seg = seg;
+    ws->iface = NULL;
+    ws->num_banks = -1;
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return;
+
+    iface = inst->chip->interface;
+    if (!iface->gpio_update_drives)
+        return;
+    ws->iface = iface;
+    ws->priv = inst->priv;
+    ws->offset = seg->gpio_base - inst->base;
+    if (iface->gpio_get_drive_banks)
+        ws->num_banks = iface->gpio_get_drive_banks(inst->priv, ws->offset,
+                                                    ws->banks);
+}
+
+static void gpio_wave_apply(const GPIO_WAVE_T *wave, const GPIO_WAVE_STEP_T *step)
+{
+    unsigned s;
+    int b;
+
+    for (s = 0; s < wave->group->num_segments; s++)
+    {
+        const GPIO_WAVE_SEGMENT_T *ws = &wave->segments[s];
+        uint32_t set_bits = gpio_group_scatter(wave->group, ws->seg, step->set_mask);
+        uint32_t clr_bits = gpio_group_scatter(wave->group, ws->seg, step->clear_mask);
+
+        clr_bits &= ~set_bits;
+        if (!(set_bits | clr_bits))
+            continue;
+
+        if (ws->num_banks < 0)
+        {
+            if (ws->iface)
+                ws->iface->gpio_update_drives(ws->priv, ws->offset,
+                                              set_bits, clr_bits, 0);
+            else
+                gpio_update_drives(ws->seg->gpio_base, set_bits, clr_bits, 0);
+            continue;
+        }
+
+        for (b = 0; b < ws->num_banks; b++)
+        {
+            const GPIO_DRIVE_BANK_T *bank = &ws->banks[b];
+            uint32_t set = set_bits & bank->mask;
+            uint32_t clr = clr_bits & bank->mask;
+
+            if (bank->shift >= 0)
+            {
+                set <<= bank->shift;
+                clr <<= bank->shift;
+            }
+            else
+            {
+                set >>= -bank->shift;
+                clr >>= -bank->shift;
+            }
+            if (set)
+                *bank->set = set;
+            if (clr)
+                *bank->clr = clr;
+        }
+    }
+}
+
+/* The thread bypasses the shadow, so give it the drives left by the last
+ * step to touch each GPIO - every repeat ends the same way.
+ */
+static void gpio_wave_update_shadow(const GPIO_WAVE_T *wave)
+{
+    unsigned s, i;
+
+    for (s = 0; s < wave->group->num_segments; s++)
+    {
+        const GPIO_GROUP_SEGMENT_T *seg = &wave->group->segments[s];
+        GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(seg->gpio_base);
+        uint32_t set = 0, clr = 0, xor = 0;
+
+        if (!inst || !inst->shadow)
+            continue;
+        for (i = 0; i < wave->num_steps; i++)
+        {
+            uint32_t set_bits = gpio_group_scatter(wave->group, seg, wave->steps[i].set_mask);
+            uint32_t clr_bits = gpio_group_scatter(wave->group, seg, wave->steps[i].clear_mask);
+
+            clr_bits &= ~set_bits;
+            set = (set & ~clr_bits) | set_bits;
+            clr = (clr & ~set_bits) | clr_bits;
+        }
+        gpio_shadow_update_drives(&inst->shadow[seg->gpio_base - inst->base],
+                                  &set, &clr, &xor);
+    }
+}
+
+static void *gpio_wave_thread(void *arg)
+{
+    GPIO_WAVE_T *wave = arg;
+    uint64_t deadline, now;
+    unsigned r, i, k = 0;
+
+    // Absolute deadlines, so that lateness doesn't accumulate
+    deadline = gpio_time_ns();
+    for (r = 0; r < wave->repeat; r++)
+    {
+        for (i = 0; i < wave->num_steps; i++, k++)
+        {
+            const GPIO_WAVE_STEP_T *step = &wave->steps[i];
+
+            deadline += step->delay_ns;
+            now = gpio_time_ns();
+            if (deadline > now + GPIO_WAVE_SPIN_NS)
+            {
+                uint64_t wake = deadline - GPIO_WAVE_SPIN_NS;
+                struct timespec ts;
+
+                ts.tv_sec = wake / 1000000000;
+                ts.tv_nsec = wake % 1000000000;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                       NULL) == EINTR)
+                    continue;
+            }
+            do
+                now = gpio_time_ns();
+            while (now < deadline);
+
+            gpio_wave_apply(wave, step);
+            now = gpio_time_ns();
+            wave->errors[k] = (now - deadline > UINT32_MAX) ?
+                UINT32_MAX : (uint32_t)(now - deadline);
+        }
+    }
+
+    return NULL;
+}
+
+static int gpio_compare_u32(const void *a, const void *b)
+{
+    uint32_t va = *(const uint32_t *)a, vb = *(const uint32_t *)b;
+
+    return (va > vb) - (va < vb);
+}
+
+int gpio_wave_play(GPIO_GROUP_T *group, const GPIO_WAVE_STEP_T *steps,
+                   unsigned num_steps, unsigned repeat, GPIO_WAVE_STATS_T *stats)
+{
+    struct sched_param param;
+    pthread_attr_t attr;
+    pthread_t thread;
+    GPIO_WAVE_T wave;
+    uint64_t total = 0;
+    unsigned count, i;
+    int ret;
+
+    if (!group || !num_steps || !repeat || num_steps > UINT32_MAX / repeat)
+        return -1;
+
+    count = num_steps * repeat;
+    wave.group = group;
+    wave.steps = steps;
+    wave.num_steps = num_steps;
+    wave.repeat = repeat;
+    wave.errors = calloc(count, sizeof(uint32_t));
+    wave.segments = calloc(group->num_segments, sizeof(*wave.segments));
+    if (!wave.errors || !wave.segments)
+    {
+        free(wave.errors);
+        free(wave.segments);
+        return -1;
+    }
+    for (i = 0; i < group->num_segments; i++)
+        gpio_wave_resolve(&group->segments[i], &wave.segments[i]);
+
+    // Use a real-time thread if permitted, otherwise a normal one
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&thread, &attr, gpio_wave_thread, &wave);
+    pthread_attr_destroy(&attr);
+    if (ret == EPERM)
+        ret = pthread_create(&thread, NULL, gpio_wave_thread, &wave);
+    if (ret)
+    {
+        free(wave.errors);
+        free(wave.segments);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    gpio_wave_update_shadow(&wave);
+
+    if (stats)
+    {
+        qsort(wave.errors, count, sizeof(uint32_t), gpio_compare_u32);
+        for (i = 0; i < count; i++)
+            total += wave.errors[i];
+        stats->num_steps = count;
+        stats->min_ns = wave.errors[0];
+        stats->max_ns = wave.errors[count - 1];
+        stats->mean_ns = (uint32_t)(total / count);
+        stats->p99_ns = wave.errors[(uint64_t)(count - 1) * 99 / 100];
+    }
+
+    free(wave.errors);
+    free(wave.segments);
+    return 0;
+}
+
+int gpio_get_level(unsigned gpio)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    unsigned gpio_offset;
+    void *priv;
+
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+        return iface->gpio_get_level(priv, gpio_offset);
+    return 0;
+}
+
+int gpio_get_levels(unsigned gpio_base, uint32_t mask, uint32_t *levels)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    int i;
+
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return -1;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    // Ignore any GPIOs beyond the end of the chip
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    if (iface->gpio_get_levels)
+        return iface->gpio_get_levels(inst->priv, offset, mask, levels);
+
+    *levels = 0;
+    for (i = 0; i < 32; i++)
+    {
+        if ((mask & (1U << i)) &&
+            iface->gpio_get_level(inst->priv, offset + i) == 1)
+            *levels |= (1U << i);
+    }
+    return 0;
+}
+
+int gpio_get_dirs(unsigned gpio_base, uint32_t mask, uint32_t *dirs)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    int i;
+
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return -1;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    // Ignore any GPIOs beyond the end of the chip
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    if (iface->gpio_get_dirs)
+        return iface->gpio_get_dirs(inst->priv, offset, mask, dirs);
+
+    *dirs = 0;
+    for (i = 0; i < 32; i++)
+    {
+        if ((mask & (1U << i)) &&
+            iface->gpio_get_dir(inst->priv, offset + i) == DIR_OUTPUT)
+            *dirs |= (1U << i);
+    }
+    return 0;
+}
+
+int gpio_get_edges(unsigned gpio_base, uint32_t mask, uint32_t *rising,
+                   uint32_t *falling)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return -1;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    // Only chips with edge detectors that can be read back support this
+    if (!iface->gpio_get_edges)
+        return -1;
+
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    return iface->gpio_get_edges(inst->priv, offset, mask, rising, falling);
+}
+
+GPIO_DRIVE_T gpio_get_drive(unsigned gpio)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_SHADOW_T *shadow = gpio_get_shadow(gpio);
+    unsigned gpio_offset;
+    void *priv;
+
+    if (shadow)
+        return shadow->drive;
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+        return iface->gpio_get_drive(priv, gpio_offset);
+    return DRIVE_MAX;
+}
+
+GPIO_PULL_T gpio_get_pull(unsigned gpio)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_SHADOW_T *shadow = gpio_get_shadow(gpio);
+    unsigned gpio_offset;
+    void *priv;
+
+    if (shadow)
+        return shadow->pull;
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+        return iface->gpio_get_pull(priv, gpio_offset);
+    return PULL_MAX;
+}
+
+void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    unsigned gpio_offset;
+    void *priv;
+
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+    {
+        iface->gpio_set_pull(priv, gpio_offset, pull);
+        gpio_shadow_set(gpio, GPIO_FSEL_MAX, DIR_MAX, DRIVE_MAX, pull);
+    }
+}
+
+void gpio_set_pull_mask(unsigned gpio_base, uint32_t mask, GPIO_PULL_T pull)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    int i;
+
+    if (!inst || pull >= PULL_MAX || gpio_chip_ready(inst) != 0)
+        return;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    // Ignore any GPIOs beyond the end of the chip
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    if (iface->gpio_set_pulls)
+    {
+        iface->gpio_set_pulls(inst->priv, offset, mask, pull);
+    }
+    else
+    {
+        for (i = 0; i < 32; i++)
+        {
+            if (mask & (1U << i))
+                iface->gpio_set_pull(inst->priv, offset + i, pull);
+        }
+    }
+
+    for (i = 0; inst->shadow && i < 32; i++)
+    {
+        if (mask & (1U << i))
+            gpio_shadow_set(gpio_base + i, GPIO_FSEL_MAX, DIR_MAX, DRIVE_MAX, pull);
+    }
+}
+
+int gpio_get_pad_ctrl(unsigned gpio, GPIO_PAD_CTRL_T *ctrl)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    unsigned gpio_offset;
+    void *priv;
+
+    ctrl->strength = STRENGTH_MAX;
+    ctrl->slew = SLEW_MAX;
+    ctrl->schmitt = SCHMITT_MAX;
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0 &&
+        iface->gpio_get_pad_ctrl)
+        return iface->gpio_get_pad_ctrl(priv, gpio_offset, ctrl);
+    return -1;
+}
+
+void gpio_set_pad_ctrl(unsigned gpio, const GPIO_PAD_CTRL_T *ctrl)
+{
+    gpio_set_pad_ctrl_mask(gpio, 1, ctrl);
+}
+
+void gpio_set_pad_ctrl_mask(unsigned gpio_base, uint32_t mask,
+                            const GPIO_PAD_CTRL_T *ctrl)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio_base);
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned offset;
+    int i;
+
+    if (!inst || gpio_chip_ready(inst) != 0)
+        return;
+
+    iface = inst->chip->interface;
+    offset = gpio_base - inst->base;
+
+    if (inst->num_gpios - offset < 32)
+        mask &= (1U << (inst->num_gpios - offset)) - 1;
+
+    if (iface->gpio_set_pad_ctrls)
+    {
+        iface->gpio_set_pad_ctrls(inst->priv, offset, mask, ctrl);
+    }
+    else if (iface->gpio_set_pad_ctrl)
+    {
+        for (i = 0; i < 32; i++)
+        {
+            if (mask & (1U << i))
+                iface->gpio_set_pad_ctrl(inst->priv, offset + i, ctrl);
+        }
+    }
+
+    // The raw pad bits have changed
+    for (i = 0; inst->shadow && i < 32; i++)
+    {
+        if (mask & (1U << i))
+            inst->shadow[offset + i].stale = 1;
+    }
+}
+
+int gpio_snapshot(unsigned first, unsigned count, GPIO_PIN_STATE_T *states)
+{
+    unsigned i;
+
+    if (first >= MAX_GPIO_PINS || count > MAX_GPIO_PINS - first)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        states[i].fsel = GPIO_FSEL_MAX;
+        states[i].dir = DIR_MAX;
+        states[i].drive = DRIVE_MAX;
+        states[i].pull = PULL_MAX;
+        states[i].level = -1;
+    }
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+        const GPIO_CHIP_INTERFACE_T *iface = inst->chip->interface;
+        unsigned lo = first, hi = first + count;
+        unsigned gpio;
+
+        if (lo < inst->base)
+            lo = inst->base;
+        if (hi > inst->base + inst->num_gpios)
+            hi = inst->base + inst->num_gpios;
+        if (lo >= hi || gpio_chip_ready(inst) != 0)
+            continue;
+
+        if (iface->gpio_get_state)
+        {
+            iface->gpio_get_state(inst->priv, lo - inst->base, hi - lo,
+                                  &states[lo - first]);
+        }
+        else
+        {
+            // Fall back to the per-pin accessors
+            for (gpio = lo; gpio < hi; gpio++)
+            {
+                GPIO_PIN_STATE_T *state = &states[gpio - first];
+                unsigned offset = gpio - inst->base;
+
+                if (!gpio_names[gpio])
+                    continue;
+                state->fsel = iface->gpio_get_fsel(inst->priv, offset);
+                state->dir = iface->gpio_get_dir(inst->priv, offset);
+                state->drive = iface->gpio_get_drive(inst->priv, offset);
+                state->pull = iface->gpio_get_pull(inst->priv, offset);
+                state->level = iface->gpio_get_level(inst->priv, offset);
+            }
+        }
+
+        // Fill in anything the chip can't report from what was written
+        for (gpio = lo; inst->shadow && gpio < hi; gpio++)
+        {
+            GPIO_PIN_STATE_T *state = &states[gpio - first];
+            const GPIO_SHADOW_T *shadow = &inst->shadow[gpio - inst->base];
+
+            if (state->drive == DRIVE_MAX)
+                state->drive = shadow->drive;
+            if (state->pull == PULL_MAX)
+                state->pull = shadow->pull;
+        }
+
+        // Resolve GPIO_FSEL_GPIO as gpio_get_fsel does
+        for (gpio = lo; gpio < hi; gpio++)
+        {
+            GPIO_PIN_STATE_T *state = &states[gpio - first];
+
+            if (state->fsel == GPIO_FSEL_GPIO)
+                state->fsel = (state->dir == DIR_OUTPUT) ? GPIO_FSEL_OUTPUT :
+                                                           GPIO_FSEL_INPUT;
+        }
+    }
+
+    return 0;
+}
+
+/* Convert a snapshot entry into the configuration that would recreate it */
+static void gpio_state_to_config(const GPIO_PIN_STATE_T *state,
+                                 GPIO_PIN_CONFIG_T *config)
+{
+    config->fsel = state->fsel;
+    config->dir = state->dir;
+    config->drive = state->drive;
+    config->pull = state->pull;
+    config->pad = -1;
+
+    // An output whose drive can't be read back is driving its level
+    if (config->drive == DRIVE_MAX && state->dir == DIR_OUTPUT &&
+        state->level >= 0)
+        config->drive = state->level ? DRIVE_HIGH : DRIVE_LOW;
+}
+
+int gpio_get_config(unsigned first, unsigned count, GPIO_PIN_CONFIG_T *configs)
+{
+    GPIO_PIN_STATE_T states[MAX_GPIO_PINS];
+    unsigned i;
+
+    if (gpio_snapshot(first, count, states) != 0)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(first + i);
+        const GPIO_CHIP_INTERFACE_T *iface;
+        GPIO_SHADOW_T *shadow;
+
+        gpio_state_to_config(&states[i], &configs[i]);
+        if (!inst || !gpio_names[first + i] || gpio_chip_ready(inst) != 0)
+            continue;
+        iface = inst->chip->interface;
+        shadow = gpio_get_shadow(first + i);
+        if (shadow)
+            configs[i].pad = shadow->pad;
+        else if (iface->gpio_get_pad)
+            configs[i].pad = iface->gpio_get_pad(inst->priv, first + i - inst->base);
+    }
+
+    return 0;
+}
+
+int gpio_apply_config(unsigned first, unsigned count,
+                      const GPIO_PIN_CONFIG_T *configs)
+{
+    GPIO_PIN_STATE_T states[MAX_GPIO_PINS];
+    unsigned i;
+
+    if (first >= MAX_GPIO_PINS || count > MAX_GPIO_PINS - first)
+        return -1;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+        const GPIO_CHIP_INTERFACE_T *iface = inst->chip->interface;
+        unsigned lo = first, hi = first + count;
+        unsigned gpio;
+
+        if (lo < inst->base)
+            lo = inst->base;
+        if (hi > inst->base + inst->num_gpios)
+            hi = inst->base + inst->num_gpios;
+        if (lo >= hi || gpio_chip_ready(inst) != 0)
+            continue;
+
+        if (iface->gpio_apply_config)
+        {
+            iface->gpio_apply_config(inst->priv, lo - inst->base, hi - lo,
+                                     &configs[lo - first]);
+            for (gpio = lo; inst->shadow && gpio < hi; gpio++)
+            {
+                if (gpio_names[gpio])
+                    gpio_shadow_record(&inst->shadow[gpio - inst->base],
+                                       &configs[gpio - first]);
+            }
+            continue;
+        }
+
+        // Otherwise diff against a snapshot, only calling the setters needed
+        gpio_snapshot(lo, hi - lo, states);
+        for (gpio = lo; gpio < hi; gpio++)
+        {
+            const GPIO_PIN_CONFIG_T *config = &configs[gpio - first];
+            const GPIO_PIN_STATE_T *cur = &states[gpio - lo];
+            GPIO_SHADOW_T *shadow = gpio_get_shadow(gpio);
+            unsigned offset = gpio - inst->base;
+
+            if (!gpio_names[gpio])
+                continue;
+
+            // Set the drive before the function, so an output doesn't glitch
+            if (config->drive < DRIVE_MAX && config->drive != cur->drive)
+                iface->gpio_set_drive(inst->priv, offset, config->drive);
+            if (config->fsel < GPIO_FSEL_MAX && config->fsel != cur->fsel)
+                iface->gpio_set_fsel(inst->priv, offset, config->fsel);
+            if (config->dir < DIR_MAX && config->dir != cur->dir &&
+                config->fsel != GPIO_FSEL_INPUT && config->fsel != GPIO_FSEL_OUTPUT)
+                iface->gpio_set_dir(inst->priv, offset, config->dir);
+            if (config->pull < PULL_MAX && config->pull != cur->pull)
+                iface->gpio_set_pull(inst->priv, offset, config->pull);
+
+            // Last, as changing the function or pull can change the pad
+            if (config->pad >= 0 && iface->gpio_get_pad && iface->gpio_set_pad &&
+                (shadow ? shadow->pad : iface->gpio_get_pad(inst->priv, offset)) != config->pad)
+                iface->gpio_set_pad(inst->priv, offset, (uint32_t)config->pad);
+
+            if (shadow)
+                gpio_shadow_record(shadow, config);
+        }
+    }
+
+    return 0;
+}
+
+void gpio_get_pin_range(unsigned *first, unsigned *last)
+{
+    if (first_hdr_pin == GPIO_INVALID)
+    {
+        unsigned i;
+
+        for (i = 0; i < num_gpio_chips; i++)
+        {
+            if (!strncmp(gpio_chips[i].name, "bcm2", 4) ||
+                !strcmp(gpio_chips[i].name, "rp1"))
+            {
+                // Assume it's the standard RPi 40-pin header layout
+                uint32_t base = gpio_chips[i].base;
+
+                hdr_gpios[3] = base + 2;
+                hdr_gpios[5] = base + 3;
+                hdr_gpios[7] = base + 4;
+                hdr_gpios[8] = base + 14;
+                hdr_gpios[10] = base + 15;
+                hdr_gpios[11] = base + 17;
+                hdr_gpios[12] = base + 18;
+                hdr_gpios[13] = base + 27;
+                hdr_gpios[15] = base + 22;
+                hdr_gpios[16] = base + 23;
+                hdr_gpios[18] = base + 24;
+                hdr_gpios[19] = base + 10;
+                hdr_gpios[21] = base + 9;
+                hdr_gpios[18] = base + 24;
+                hdr_gpios[22] = base + 25;
+                hdr_gpios[23] = base + 11;
+                hdr_gpios[24] = base + 8;
+                hdr_gpios[26] = base + 7;
+                hdr_gpios[27] = base + 0;
+                hdr_gpios[28] = base + 1;
+                hdr_gpios[29] = base + 5;
+                hdr_gpios[31] = base + 6;
+                hdr_gpios[32] = base + 12;
+                hdr_gpios[33] = base + 13;
+                hdr_gpios[35] = base + 19;
+                hdr_gpios[36] = base + 16;
+                hdr_gpios[37] = base + 26;
+                hdr_gpios[38] = base + 20;
+                hdr_gpios[40] = base + 21;
+
+                first_hdr_pin = 1;
+                last_hdr_pin = 40;
+                break;
+            }
+        }
+    }
+    if (first)
+        *first = first_hdr_pin;
+    if (last)
+        *last = last_hdr_pin;
+}
+
+unsigned gpio_for_pin(int pin)
+{
+    if (pin >= 1 && pin <= NUM_HDR_PINS)
+        return hdr_gpios[pin];
+    return GPIO_INVALID;
+}
+
+int gpio_to_pin(unsigned gpio)
+{
+    int i;
+
+    for (i = 1; i <= NUM_HDR_PINS; i++)
+    {
         if (hdr_gpios[i] == gpio)
             return i;
     }
     return -1;
 }
 
+static uint32_t gpio_name_hash(const char *name, int len)
+{
+    uint32_t hash = 2166136261u;
+
+    // FNV-1a
+    while (len--)
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    return hash;
+}
+
+static void gpio_build_name_index(void)
+{
+    unsigned count = 0, size;
+    unsigned gpio;
+
+    free(name_index);
+    name_index = NULL;
+
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        const char *p = gpio_names[gpio];
+
+        while (p && *p)
+        {
+            count++;
+            p += strcspn(p, "/");
+            if (*p == '/')
+                p++;
+        }
+    }
+
+    // Keep the table at most half full
+    for (size = 16; size < count * 2; size *= 2)
+        continue;
+    name_index = calloc(size, sizeof(*name_index));
+    if (!name_index)
+        return;
+    name_index_mask = size - 1;
+
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        const char *p = gpio_names[gpio];
+
+        while (p && *p)
+        {
+            int len = strcspn(p, "/");
+            unsigned slot = gpio_name_hash(p, len) & name_index_mask;
+            GPIO_NAME_ENTRY_T *entry;
+
+            // Linear probing - the first (lowest) GPIO with a name wins
+            for (entry = &name_index[slot]; entry->name;
+                 entry = &name_index[slot])
+            {
+                if (entry->len == len && memcmp(entry->name, p, len) == 0)
+                    break;
+                slot = (slot + 1) & name_index_mask;
+            }
+            if (!entry->name)
+            {
+                entry->name = p;
+                entry->len = (uint16_t)len;
+                entry->gpio = (uint16_t)gpio;
+            }
+
+            p += len;
+            if (*p == '/')
+                p++;
+        }
+    }
+}
+
 unsigned gpio_get_gpio_by_name(const char *name, int name_len)
 {
     unsigned gpio;
 
     if (!name_len)
         name_len = strlen(name);
+
+    if (name_index)
+    {
+        unsigned slot = gpio_name_hash(name, name_len) & name_index_mask;
+
+        for (; name_index[slot].name; slot = (slot + 1) & name_index_mask)
+        {
+            const GPIO_NAME_ENTRY_T *entry = &name_index[slot];
+            if (entry->len == name_len && memcmp(entry->name, name, name_len) == 0)
+                return entry->gpio;
+        }
+        return GPIO_INVALID;
+    }
+
+    // No index (out of memory) - fall back to a linear search
     for (gpio = 0; gpio < num_gpios; gpio++)
     {
         const char *gpio_name = gpio_names[gpio];
@@ -344,125 +1692,659 @@ unsigned gpio_get_gpio_by_name(const char *name, int name_len)
         }
     }
 
-    return GPIO_INVALID;
+    return GPIO_INVALID;
+}
+
+const char *gpio_get_name(unsigned gpio)
+{
+    if (gpio < num_gpios)
+        return gpio_names[gpio];
+    switch (gpio)
+    {
+    case GPIO_INVALID:
+        return "-";
+    case GPIO_GND:
+        return "gnd";
+    case GPIO_5V:
+        return "5v";
+    case GPIO_3V3:
+        return "3v3";
+    case GPIO_1V8:
+        return "1v8";
+    case GPIO_OTHER:
+    default:
+        return "???";
+    }
+}
+
+static unsigned gpio_chardev_number(const char *path)
+{
+    return (unsigned)strtoul(path + strlen("/dev/gpiochip"), NULL, 10);
+}
+
+/* Some drivers (such as gpio-brcmstb) register a kernel gpiochip for each
+ * bank of a node. A driver registers its banks in order, so they have
+ * ascending numbers, and their line counts give the base of each. If they
+ * don't add up to the GPIOs of the chip, the lines can't be located, so
+ * leave the chip without character devices.
+ */
+static void gpio_resolve_banks(GPIO_CHIP_INSTANCE_T *inst)
+{
+    char *paths[MAX_CHIP_BANKS];
+    char *list, *tok, *save;
+    unsigned num_paths = 0, lines = 0, i, j;
+
+    inst->num_banks = 0;
+    if (!inst->chardev || !(list = strdup(inst->chardev)))
+        return;
+
+    for (tok = strtok_r(list, " ", &save); tok; tok = strtok_r(NULL, " ", &save))
+    {
+        if (num_paths == MAX_CHIP_BANKS)
+            goto done;
+        for (i = num_paths++; i > 0 &&
+             gpio_chardev_number(paths[i - 1]) > gpio_chardev_number(tok); i--)
+            paths[i] = paths[i - 1];
+        paths[i] = tok;
+    }
+
+    for (i = 0; i < num_paths; i++)
+    {
+        struct gpiochip_info info;
+        int fd, ret;
+
+        fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            goto done;
+        ret = ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info);
+        close(fd);
+        if (ret < 0)
+            goto done;
+        inst->bank_bases[i] = lines;
+        lines += info.lines;
+    }
+    if (lines < inst->num_gpios || (num_paths > 1 && lines != inst->num_gpios))
+        goto done;
+
+    for (i = 0; i < num_paths; i++)
+    {
+        inst->bank_chardevs[i] = strdup(paths[i]);
+        if (!inst->bank_chardevs[i])
+        {
+            for (j = 0; j < i; j++)
+                free(inst->bank_chardevs[j]);
+            goto done;
+        }
+    }
+    inst->num_banks = num_paths;
+
+done:
+    free(list);
+}
+
+/* Not thread-safe the first time it is called for each chip */
+const char *gpio_get_chardev(unsigned gpio, unsigned *line)
+{
+    GPIO_CHIP_INSTANCE_T *inst = gpio_get_instance(gpio);
+    unsigned offset;
+    int i;
+
+    if (!inst)
+        return NULL;
+    if (inst->num_banks < 0)
+        gpio_resolve_banks(inst);
+
+    offset = gpio - inst->base;
+    for (i = inst->num_banks - 1; i >= 0; i--)
+    {
+        if (offset >= inst->bank_bases[i])
+        {
+            if (line)
+                *line = offset - inst->bank_bases[i];
+            return inst->bank_chardevs[i];
+        }
+    }
+    return NULL;
+}
+
+const char *gpio_get_gpio_fsel_name(unsigned gpio, GPIO_FSEL_T fsel)
+{
+    const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    unsigned gpio_offset;
+    void *priv;
+
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
+        return iface->gpio_get_fsel_name(priv, gpio_offset, fsel);
+    return NULL;
+}
+
+const char *gpio_get_fsel_name(GPIO_FSEL_T fsel)
+{
+    if ((unsigned)fsel < ARRAY_SIZE(fsel_names))
+        return fsel_names[fsel];
+    return NULL;
+}
+
+const char *gpio_get_pull_name(GPIO_PULL_T pull)
+{
+    if ((unsigned)pull < ARRAY_SIZE(pull_names))
+        return pull_names[pull];
+    return NULL;
+}
+
+const char *gpio_get_drive_name(GPIO_DRIVE_T drive)
+{
+    if ((unsigned)drive < ARRAY_SIZE(drive_names))
+        return drive_names[drive];
+    return NULL;
+}
+
+const char *gpio_get_strength_name(GPIO_STRENGTH_T strength)
+{
+    if ((unsigned)strength < ARRAY_SIZE(strength_names))
+        return strength_names[strength];
+    return NULL;
+}
+
+static const GPIO_CHIP_T *gpio_find_chip(const char *name)
+{
+#if LIBRARY_BUILD
+    const GPIO_CHIP_T *const *start = &library_gpiochips[0];
+    const GPIO_CHIP_T *const *end = &library_gpiochips[0] + library_gpiochips_count;
+#else
+    const GPIO_CHIP_T *const *start = &__start_gpiochips;
+    const GPIO_CHIP_T *const *end = &__stop_gpiochips;
+#endif
+    const GPIO_CHIP_T *const *chip_ptr;
+
+    for (chip_ptr = start; name && chip_ptr < end; chip_ptr++) {
+        const GPIO_CHIP_T *chip = *chip_ptr;
+        if (!strcmp(name, chip->name) ||
+            !strcmp(name, chip->compatible))
+            return chip;
+    }
+
+    return NULL;
+}
+
+/* The driver for a Device Tree node, or NULL if there isn't one, with the
+ * node's physical address in *phys_addr (0 if the chip has no registers).
+ */
+static const GPIO_CHIP_T *gpio_dtnode_chip(const char *dtnode, uint64_t *phys_addr)
+{
+    char pathbuf[FILENAME_MAX];
+    const GPIO_CHIP_T *chip;
+    char *compatible;
+
+    compatible = dt_read_prop(dtnode, "compatible", NULL);
+    if (!compatible)
+    {
+        snprintf(pathbuf, sizeof(pathbuf), "%s/..", dtnode);
+        compatible = dt_read_prop(pathbuf, "compatible", NULL);
+    }
+
+    chip = gpio_find_chip(compatible);
+    dt_free(compatible);
+    if (!chip)
+        return NULL;
+
+    *phys_addr = 0;
+    if (chip->size)
+    {
+        *phys_addr = dt_parse_addr(dtnode);
+        if (*phys_addr == INVALID_ADDRESS)
+            return NULL;
+    }
+    return chip;
+}
+
+static GPIO_CHIP_INSTANCE_T *gpio_add_chip_instance(const char *dtnode, const char *gpiomem_idx)
+{
+    char pathbuf[FILENAME_MAX];
+    GPIO_CHIP_INSTANCE_T *inst;
+    const GPIO_CHIP_T *chip;
+    uint64_t phys_addr;
+
+    // Skip unknown gpio chips
+    chip = gpio_dtnode_chip(dtnode, &phys_addr);
+    if (!chip)
+        return NULL;
+
+    inst = gpio_create_instance(chip, phys_addr, NULL, dtnode);
+    // Skip duplicates (or if there is an error)
+    if (!inst)
+        return NULL;
+
+    // A DTB file may not even describe this system
+    inst->mem_fd = -1;
+    if (dt_offline)
+        return inst;
+
+    sprintf(pathbuf, "/dev/gpiomem%s", gpiomem_idx);
+    inst->mem_fd = open(pathbuf, O_RDWR|O_SYNC);
+    if (inst->mem_fd >= 0)
+        inst->mem_path = strdup(pathbuf);
+    return inst;
+}
+
+static void gpio_add_chardev(GPIO_CHIP_INSTANCE_T *inst, const char *name)
+{
+    char *list;
+
+    if (inst->chardev)
+        list = malloc(strlen(inst->chardev) + strlen(name) + 7);
+    else
+        list = malloc(strlen(name) + 6);
+    if (!list)
+        return;
+    if (inst->chardev)
+        sprintf(list, "%s /dev/%s", inst->chardev, name);
+    else
+        sprintf(list, "/dev/%s", name);
+    free(inst->chardev);
+    inst->chardev = list;
+}
+
+static void gpio_scan_dt_controllers(const char *node)
+{
+    DT_SUBNODE_HANDLE subnodes;
+    const char *subnode;
+    char pathbuf[FILENAME_MAX];
+
+    subnodes = dt_open_subnodes(node);
+    if (!subnodes)
+        return;
+
+    while ((subnode = dt_next_subnode(subnodes)) != NULL)
+    {
+        char *prop, *dtnode;
+
+        if (snprintf(pathbuf, sizeof(pathbuf), "%s/%s",
+                     node[1] ? node : "", subnode) >= (int)sizeof(pathbuf))
+            continue;
+
+        prop = dt_read_prop(pathbuf, "gpio-controller", NULL);
+        if (prop)
+        {
+            dt_free(prop);
+            dtnode = strdup(pathbuf);
+            if (dtnode && !gpio_add_chip_instance(dtnode, ""))
+                free(dtnode);
+        }
+
+        gpio_scan_dt_controllers(pathbuf);
+    }
+
+    dt_close_subnodes(subnodes);
 }
 
-const char *gpio_get_name(unsigned gpio)
+static uint64_t gpio_cache_hash(uint64_t hash, const void *data, size_t len)
 {
-    if (gpio < num_gpios)
-        return gpio_names[gpio];
-    switch (gpio)
+    const uint8_t *p = data;
+
+    // 64-bit FNV-1a
+    while (len--)
+        hash = (hash ^ *p++) * 1099511628211ull;
+    return hash;
+}
+
+/* Hash the names of the entries of a directory, and optionally their
+ * change times, in the order they are listed.
+ */
+static uint64_t gpio_cache_hash_dir(uint64_t hash, const char *path, int times)
+{
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+
+    dir = opendir(path);
+    if (!dir)
+        return gpio_cache_hash(hash, "", 1);
+    while ((de = readdir(dir)) != NULL)
     {
-    case GPIO_INVALID:
-        return "-";
-    case GPIO_GND:
-        return "gnd";
-    case GPIO_5V:
-        return "5v";
-    case GPIO_3V3:
-        return "3v3";
-    case GPIO_1V8:
-        return "1v8";
-    case GPIO_OTHER:
-    default:
-        return "???";
+        if (de->d_name[0] == '.')
+            continue;
+        hash = gpio_cache_hash(hash, de->d_name, strlen(de->d_name) + 1);
+        if (times && fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            hash = gpio_cache_hash(hash, &st.st_ctim.tv_sec, sizeof(st.st_ctim.tv_sec));
+            hash = gpio_cache_hash(hash, &st.st_ctim.tv_nsec, sizeof(st.st_ctim.tv_nsec));
+        }
     }
+    closedir(dir);
+    return hash;
 }
 
-const char *gpio_get_gpio_fsel_name(unsigned gpio, GPIO_FSEL_T fsel)
+/* Whether any runtime overlays have been applied through configfs */
+static int gpio_dt_has_overlays(void)
 {
-    const GPIO_CHIP_INTERFACE_T *iface = NULL;
-    unsigned gpio_offset;
-    void *priv;
+    struct dirent *de;
+    DIR *dir;
+    int found = 0;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_fsel_name(priv, gpio_offset, fsel);
-    return NULL;
+    dir = opendir("/sys/kernel/config/device-tree/overlays");
+    if (!dir)
+        return 0;
+    while (!found && (de = readdir(dir)) != NULL)
+        found = (de->d_name[0] != '.');
+    closedir(dir);
+    return found;
 }
 
-const char *gpio_get_fsel_name(GPIO_FSEL_T fsel)
+/* The key combines the boot ID with the runtime overlays (with their
+ * creation times, so that an overlay removed and applied again is noticed)
+ * and the registered GPIO devices, which change when a GPIO driver is
+ * loaded. The live tree only changes through overlays, so that is enough
+ * to notice any change to the controllers, for one file read and two
+ * directory listings.
+ */
+static int gpio_cache_key(char *key)
 {
-    if ((unsigned)fsel < ARRAY_SIZE(fsel_names))
-        return fsel_names[fsel];
-    return NULL;
+    char boot_id[40];
+    uint64_t hash = 14695981039346656037ull;
+    ssize_t len;
+    int fd;
+
+    memset(key, 0, GPIO_CACHE_KEY_LEN);
+    fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    len = read(fd, boot_id, sizeof(boot_id) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    boot_id[len] = '\0';
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+    if (!boot_id[0])
+        return -1;
+
+    hash = gpio_cache_hash_dir(hash, "/sys/kernel/config/device-tree/overlays", 1);
+    hash = gpio_cache_hash_dir(hash, "/sys/bus/gpio/devices", 0);
+
+    snprintf(key, GPIO_CACHE_KEY_LEN, "%s-%016" PRIx64, boot_id, hash);
+    return 0;
 }
 
-const char *gpio_get_pull_name(GPIO_PULL_T pull)
+static const char *gpio_cache_string(char **pos, const char *end)
 {
-    if ((unsigned)pull < ARRAY_SIZE(pull_names))
-        return pull_names[pull];
-    return NULL;
+    char *str = *pos;
+    char *nul = memchr(str, '\0', end - str);
+
+    if (!nul)
+        return NULL;
+    *pos = nul + 1;
+    return str;
 }
 
-const char *gpio_get_drive_name(GPIO_DRIVE_T drive)
+/* Non-zero if path is prefix followed by nothing but digits, as the device
+ * paths chosen by gpiolib_init are.
+ */
+static int gpio_cache_dev_valid(const char *path, const char *prefix)
 {
-    if ((unsigned)drive < ARRAY_SIZE(drive_names))
-        return drive_names[drive];
-    return NULL;
+    size_t len = strlen(prefix);
+
+    if (strncmp(path, prefix, len) != 0)
+        return 0;
+    return strspn(path + len, "0123456789") == strlen(path + len);
 }
 
-static const GPIO_CHIP_T *gpio_find_chip(const char *name)
+static int gpio_cache_chardevs_valid(const char *list)
 {
-#if LIBRARY_BUILD
-    const GPIO_CHIP_T *const *start = &library_gpiochips[0];
-    const GPIO_CHIP_T *const *end = &library_gpiochips[0] + library_gpiochips_count;
-#else
-    const GPIO_CHIP_T *const *start = &__start_gpiochips;
-    const GPIO_CHIP_T *const *end = &__stop_gpiochips;
-#endif
-    const GPIO_CHIP_T *const *chip_ptr;
+    char path[FILENAME_MAX];
+    size_t len;
 
-    for (chip_ptr = start; name && chip_ptr < end; chip_ptr++) {
-        const GPIO_CHIP_T *chip = *chip_ptr;
-        if (!strcmp(name, chip->name) ||
-            !strcmp(name, chip->compatible))
-            return chip;
+    while (*list)
+    {
+        len = strcspn(list, " ");
+        if (len >= sizeof(path))
+            return 0;
+        memcpy(path, list, len);
+        path[len] = '\0';
+        if (!gpio_cache_dev_valid(path, "/dev/gpiochip"))
+            return 0;
+        list += len;
+        if (*list)
+            list++;
     }
+    return 1;
+}
 
-    return NULL;
+/* The cache says which files to map, so only trust one that nobody else
+ * could have written.
+ */
+static char *gpio_read_cache(size_t *plen)
+{
+    struct stat st;
+    char *buf;
+    size_t done = 0;
+    int fd;
+
+    fd = open(cache_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+        !(buf = malloc(st.st_size ? st.st_size : 1)))
+    {
+        close(fd);
+        return NULL;
+    }
+    while (done < (size_t)st.st_size)
+    {
+        ssize_t n = read(fd, buf + done, st.st_size - done);
+
+        if (n <= 0)
+        {
+            free(buf);
+            close(fd);
+            return NULL;
+        }
+        done += n;
+    }
+    close(fd);
+    *plen = done;
+    return buf;
 }
 
-static GPIO_CHIP_INSTANCE_T *gpio_add_chip_instance(const char *dtnode, const char *gpiomem_idx)
+static int gpio_load_cache(const char *key)
 {
-    char pathbuf[FILENAME_MAX];
-    GPIO_CHIP_INSTANCE_T *inst;
-    const GPIO_CHIP_T *chip;
+    GPIO_CACHE_HEADER_T *hdr;
+    GPIO_CACHE_CHIP_T recs[MAX_GPIO_CHIPS];
+    const char *strs[MAX_GPIO_CHIPS][4];
+    const GPIO_CHIP_T *chips[MAX_GPIO_CHIPS];
+    char *buf, *pos, *end;
     uint64_t phys_addr;
-    char *compatible;
+    size_t len;
+    unsigned i, gpio;
 
-    compatible = dt_read_prop(dtnode, "compatible", NULL);
-    if (!compatible)
+    buf = gpio_read_cache(&len);
+    if (!buf)
+        return -1;
+    end = buf + len;
+    hdr = (GPIO_CACHE_HEADER_T *)buf;
+
+    if (len < sizeof(*hdr) ||
+        hdr->magic != GPIO_CACHE_MAGIC ||
+        hdr->version != GPIO_CACHE_VERSION ||
+        memcmp(hdr->key, key, GPIO_CACHE_KEY_LEN) != 0 ||
+        hdr->num_chips > MAX_GPIO_CHIPS ||
+        hdr->num_gpios > MAX_GPIO_PINS)
+        goto invalid;
+
+    // Validate everything before creating any instances
+    pos = buf + sizeof(*hdr);
+    for (i = 0; i < hdr->num_chips; i++)
     {
-        sprintf(pathbuf, "%s/..", dtnode);
-        compatible = dt_read_prop(pathbuf, "compatible", NULL);
+        unsigned s;
+
+        if ((size_t)(end - pos) < sizeof(GPIO_CACHE_CHIP_T))
+            goto invalid;
+        // The records are unaligned, so copy them out
+        memcpy(&recs[i], pos, sizeof(GPIO_CACHE_CHIP_T));
+        pos += sizeof(GPIO_CACHE_CHIP_T);
+        for (s = 0; s < 4; s++)
+        {
+            strs[i][s] = gpio_cache_string(&pos, end);
+            if (!strs[i][s])
+                goto invalid;
+        }
+        chips[i] = gpio_find_chip(strs[i][0]);
+        if (!chips[i] || recs[i].base + recs[i].num_gpios > hdr->num_gpios)
+            goto invalid;
+
+        // Only map what discovery would have mapped
+        if (gpio_dtnode_chip(strs[i][1], &phys_addr) != chips[i] ||
+            phys_addr != recs[i].phys_addr ||
+            (strs[i][2][0] && !gpio_cache_dev_valid(strs[i][2], "/dev/gpiomem")) ||
+            !gpio_cache_chardevs_valid(strs[i][3]))
+            goto invalid;
     }
 
-    chip = gpio_find_chip(compatible);
-    dt_free(compatible);
+    for (gpio = 0; gpio < hdr->num_gpios; gpio++)
+    {
+        const char *name = gpio_cache_string(&pos, end);
+        if (!name)
+            goto invalid;
+        gpio_names[gpio] = name[0] ? name : NULL;
+    }
 
-    // Skip unknown gpio chips
-    if (!chip)
-        return NULL;
+    for (i = 0; i < hdr->num_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst;
 
-    if (chip->size)
+        inst = gpio_create_instance(chips[i], recs[i].phys_addr, NULL, strs[i][1]);
+        if (!inst)
+            goto discard;
+        inst->base = recs[i].base;
+        inst->num_gpios = recs[i].num_gpios;
+        inst->mem_fd = -1;
+        if (strs[i][2][0])
+        {
+            inst->mem_fd = open(strs[i][2], O_RDWR|O_SYNC);
+            inst->mem_path = strdup(strs[i][2]);
+        }
+        if (strs[i][3][0])
+            inst->chardev = strdup(strs[i][3]);
+        if (inst->num_gpios)
+            gpio_map_instance(inst);
+
+        if (verbose_callback)
+        {
+            char msg_buf[100];
+            snprintf(msg_buf, sizeof(msg_buf), "  %" PRIx64 ": %s (%d gpios, cached)\n",
+                     inst->phys_addr, inst->chip->name, inst->num_gpios);
+            (*verbose_callback)(msg_buf);
+        }
+    }
+
+    num_gpios = hdr->num_gpios;
+    first_hdr_pin = hdr->first_hdr_pin;
+    last_hdr_pin = hdr->last_hdr_pin;
+    for (i = 0; i <= NUM_HDR_PINS; i++)
+        hdr_gpios[i] = hdr->hdr_gpios[i];
+
+    // The names point into the buffer, so it is never freed
+    return 0;
+
+discard:
+    // Leave nothing behind for the full scan to trip over
+    for (i = 0; i < num_gpio_chips; i++)
     {
-        phys_addr = dt_parse_addr(dtnode);
-        if (phys_addr == INVALID_ADDRESS)
-            return NULL;
+        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+
+        if (inst->chip->interface->gpio_destroy_instance)
+            inst->chip->interface->gpio_destroy_instance(inst->priv);
+        if (inst->mem_fd >= 0)
+            close(inst->mem_fd);
+        free(inst->mem_path);
+        free(inst->chardev);
+        memset(inst, 0, sizeof(*inst));
     }
-    else
+    num_gpio_chips = 0;
+    memset(gpio_chip_map, 0, sizeof(gpio_chip_map));
+
+invalid:
+    memset(gpio_names, 0, sizeof(gpio_names));
+    free(buf);
+    return -1;
+}
+
+static void gpio_save_cache(const char *key)
+{
+    GPIO_CACHE_HEADER_T hdr;
+    char tmp_path[FILENAME_MAX];
+    unsigned i, gpio;
+    FILE *fp;
+    int fd, ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = GPIO_CACHE_MAGIC;
+    hdr.version = GPIO_CACHE_VERSION;
+    memcpy(hdr.key, key, GPIO_CACHE_KEY_LEN);
+    hdr.num_chips = num_gpio_chips;
+    hdr.num_gpios = num_gpios;
+    hdr.first_hdr_pin = first_hdr_pin;
+    hdr.last_hdr_pin = last_hdr_pin;
+    for (i = 0; i <= NUM_HDR_PINS; i++)
+        hdr.hdr_gpios[i] = hdr_gpios[i];
+
+    /* Write to a new temporary file and rename it, so readers never see a
+     * partial cache. mkstemp won't follow a planted symlink, and makes the
+     * file private to its owner, as gpio_read_cache requires.
+     */
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX",
+                 cache_path) >= (int)sizeof(tmp_path))
+        return;
+    fd = mkstemp(tmp_path);
+    if (fd < 0)
+        return;
+    fp = fdopen(fd, "wb");
+    if (!fp)
     {
-        phys_addr = 0;
+        close(fd);
+        unlink(tmp_path);
+        return;
     }
 
-    inst = gpio_create_instance(chip, phys_addr, NULL, dtnode);
-    // Skip duplicates (or if there is an error)
-    if (!inst)
-        return NULL;
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (i = 0; ok && i < num_gpio_chips; i++)
+    {
+        const GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+        GPIO_CACHE_CHIP_T rec;
+
+        memset(&rec, 0, sizeof(rec));
+        rec.phys_addr = inst->phys_addr;
+        rec.base = inst->base;
+        rec.num_gpios = inst->num_gpios;
+        ok = fwrite(&rec, sizeof(rec), 1, fp) == 1 &&
+            fprintf(fp, "%s%c%s%c%s%c%s%c",
+                    inst->chip->name, 0,
+                    inst->dtnode ? inst->dtnode : "", 0,
+                    inst->mem_path ? inst->mem_path : "", 0,
+                    inst->chardev ? inst->chardev : "", 0) > 0;
+    }
+    for (gpio = 0; ok && gpio < num_gpios; gpio++)
+        ok = fprintf(fp, "%s%c", gpio_names[gpio] ? gpio_names[gpio] : "", 0) > 0;
 
-    sprintf(pathbuf, "/dev/gpiomem%s", gpiomem_idx);
-    inst->mem_fd = open(pathbuf, O_RDWR|O_SYNC);
-    return inst;
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_path, cache_path) != 0)
+        unlink(tmp_path);
+}
+
+void gpiolib_set_cache(const char *path)
+{
+    cache_path = path;
+}
+
+void gpiolib_set_dtb(const char *path)
+{
+    dtb_path = path;
+}
+
+void gpiolib_set_sim(const char *dir)
+{
+    sim_dir = dir;
 }
 
 int gpiolib_init(void)
@@ -474,6 +2356,8 @@ int gpiolib_init(void)
     const char *dtpath = "/sys/firmware/devicetree/base";
     const char *ofnode_prefix = dtpath + 4;
     const char *gpiopath = "/sys/bus/gpio/devices";
+    char cache_key[GPIO_CACHE_KEY_LEN];
+    int save_cache = 0;
     DIR *dir;
     struct dirent *de;
     const char *p;
@@ -505,6 +2389,39 @@ int gpiolib_init(void)
 
     dt_set_path(dtpath);
 
+    if (cache_path && !dtb_path && gpio_cache_key(cache_key) == 0)
+    {
+        if (gpio_load_cache(cache_key) == 0)
+        {
+            gpio_build_name_index();
+            return (int)num_gpios;
+        }
+        save_cache = 1;
+    }
+
+    /* With libfdt, the live tree is loaded from the boot-time FDT in one
+     * read, unless runtime overlays have changed it since, in which case
+     * it is read through sysfs. A saved tree can be a DTB (if built with
+     * libfdt) or a directory laid out like sysfs.
+     */
+    if (!dtb_path)
+    {
+        if (!gpio_dt_has_overlays() && dt_load_fdt("/sys/firmware/fdt") == 0)
+            dt_set_path(NULL);
+    }
+    else
+    {
+        struct stat st;
+
+        if (stat(dtb_path, &st) == 0 && S_ISDIR(st.st_mode))
+            dt_set_path(dtb_path);
+        else if (dt_load_fdt(dtb_path) == 0)
+            dt_set_path(NULL);
+        else
+            return -1;
+        dt_offline = 1;
+    }
+
     // Scan the gpio<n> aliases, stopping at the first absence
     for (i = 0; ; i++)
     {
@@ -522,8 +2439,12 @@ int gpiolib_init(void)
             dt_free(alias);
     }
 
+    // A DTB file has no accompanying sysfs, so look for the controllers
+    if (dt_offline)
+        gpio_scan_dt_controllers("/");
+
     // Now look for other gpio chips without aliases
-    dir = opendir(gpiopath);
+    dir = dt_offline ? NULL : opendir(gpiopath);
     prefix_len = strlen(ofnode_prefix);
     while (dir && ((de = readdir(dir)) != NULL))
     {
@@ -540,9 +2461,22 @@ int gpiolib_init(void)
             match = strstr(symlink, ofnode_prefix);
             if (!match)
                 continue;
-            dtnode = strdup(match + prefix_len);
-            if (dtnode && !gpio_add_chip_instance(dtnode, gpiomem_idx))
-                free(dtnode);
+            inst = gpio_find_instance(match + prefix_len);
+            if (!inst)
+            {
+                dtnode = strdup(match + prefix_len);
+                if (!dtnode)
+                    continue;
+                inst = gpio_add_chip_instance(dtnode, gpiomem_idx);
+                if (!inst)
+                {
+                    free(dtnode);
+                    continue;
+                }
+            }
+            // Remember the character devices for the line event interface
+            if (!strncmp(de->d_name, "gpiochip", 8))
+                gpio_add_chardev(inst, de->d_name);
         }
     }
 
@@ -574,6 +2508,8 @@ int gpiolib_init(void)
         if (num_gpios > MAX_GPIO_PINS)
             return -1;
 
+        gpio_map_instance(inst);
+
         names = dt_read_prop(inst->dtnode, "gpio-line-names", &names_len);
         end = names + names_len;
 
@@ -645,6 +2581,12 @@ int gpiolib_init(void)
     if (first_hdr_pin == 3)
         first_hdr_pin = 1;
 
+    // Don't cache an empty system - the drivers may not have loaded yet
+    if (save_cache && num_gpios)
+        gpio_save_cache(cache_key);
+
+    gpio_build_name_index();
+
     return (int)num_gpios;
 }
 
@@ -673,6 +2615,9 @@ int gpiolib_init_by_name(const char *name)
     inst->num_gpios = chip->interface->gpio_count(inst->priv);
 
     num_gpios = inst->num_gpios;
+    if (num_gpios > MAX_GPIO_PINS)
+        return -1;
+    gpio_map_instance(inst);
 
     for (gpio = 0; gpio < inst->num_gpios; gpio++)
     {
@@ -694,70 +2639,141 @@ int gpiolib_init_by_name(const char *name)
         (*verbose_callback)(msg_buf);
     }
 
+    gpio_build_name_index();
+
     return (int)num_gpios;
 }
 
+/* Map the chip's register window and probe it, returning 0, an errno
+ * value if the mapping fails, or -1 if the probe fails. Only called
+ * single-threaded: on first use, or for every chip when thread-safe.
+ */
+static int gpio_map_chip(GPIO_CHIP_INSTANCE_T *inst)
+{
+    const GPIO_CHIP_T *chip = inst->chip;
+    size_t len = chip->size + inst->map_align;
+    void *base, *new_priv;
+
+    inst->map_state = MAP_FAILED_STATE;
+
+    // The kernel only fills in the page table entries that are touched
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                inst->map_fd, inst->map_offset);
+    if (base == MAP_FAILED)
+        return errno;
+    inst->map_base = base;
+
+    new_priv = chip->interface->gpio_probe_instance(inst->priv,
+                                                    (void *)(inst->map_base + inst->map_align));
+    if (!new_priv)
+    {
+        munmap(base, len);
+        inst->map_base = NULL;
+        return -1;
+    }
+    inst->priv = new_priv;
+    inst->map_state = MAP_DONE;
+    return 0;
+}
+
+/* Leave nothing for the threads to set up: every chip is mapped now, and
+ * the shadow (which is updated without locks) is dropped. Handles
+ * find it gone, since they only hold the chip's pointer to it.
+ */
+static void gpio_prepare_threads(void)
+{
+    unsigned i;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+
+        if (inst->map_state == MAP_PENDING)
+            gpio_map_chip(inst);
+        free(inst->shadow);
+        inst->shadow = NULL;
+    }
+}
+
 int gpiolib_mmap(void)
 {
     int pagesize = getpagesize();
-    int mem_fd = -1;
     unsigned i;
 
+    // The hardware isn't necessarily the one described by the DTB
+    if (dt_offline && !sim_dir)
+        return ENXIO;
+
+    if (sim_dir && mkdir(sim_dir, 0755) != 0 && errno != EEXIST)
+        return errno;
+
+    /* Open everything now, so that permission problems are reported here,
+     * but leave the mapping of each chip until it is first used.
+     */
     for (i = 0; i < num_gpio_chips; i++)
     {
         GPIO_CHIP_INSTANCE_T *inst;
         const GPIO_CHIP_T *chip;
-        void *gpio_map;
-        void *new_priv;
-        unsigned align;
+        struct stat st;
 
         inst = &gpio_chips[i];
         chip = inst->chip;
 
-        if (!chip->interface->gpio_probe_instance || !chip->size)
+        if (!chip->interface->gpio_probe_instance || !chip->size ||
+            inst->map_state != MAP_NONE)
             continue;
 
-        align = inst->phys_addr & (pagesize - 1);
+        inst->map_align = inst->phys_addr & (pagesize - 1);
+        inst->map_offset = 0;
 
-        if (inst->mem_fd >= 0)
+        if (sim_dir)
+        {
+            char pathbuf[FILENAME_MAX];
+            int fd;
+
+            // A zero-filled image of the register window, kept between runs
+            snprintf(pathbuf, sizeof(pathbuf), "%s/%s@%" PRIx64 ".img",
+                     sim_dir, inst->name, inst->phys_addr);
+            fd = open(pathbuf, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return errno;
+            if (fstat(fd, &st) != 0 ||
+                (st.st_size < chip->size && ftruncate(fd, chip->size) != 0))
+            {
+                int err = errno;
+                close(fd);
+                return err;
+            }
+            inst->map_fd = fd;
+            inst->map_align = 0;
+        }
+        else if (inst->mem_fd >= 0)
         {
-            gpio_map = mmap(
-                NULL,                   /* Any address in our space will do */
-                chip->size + align,     /* Map length */
-                PROT_READ | PROT_WRITE, /* Enable reading & writing */
-                MAP_SHARED,             /* Shared with other processes */
-                inst->mem_fd,           /* File to map */
-                0                       /* Offset to GPIO peripheral */
-                );
+            inst->map_fd = inst->mem_fd;
         }
         else
         {
-            if (mem_fd < 0)
+            if (dev_mem_fd < 0)
             {
-                mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
-                if (mem_fd < 0)
+                dev_mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
+                if (dev_mem_fd < 0)
                     return errno;
             }
-            gpio_map = mmap(
-                NULL,                   /* Any address in our space will do */
-                chip->size + align,     /* Map length */
-                PROT_READ | PROT_WRITE, /* Enable reading & writing */
-                MAP_SHARED,             /* Shared with other processes */
-                mem_fd,                 /* File to map */
-                inst->phys_addr - align /* Offset to GPIO peripheral */
-                );
-        }
-
-        if (gpio_map == MAP_FAILED)
-            return errno;
-
-        new_priv = chip->interface->gpio_probe_instance(inst->priv,
-                                                        (void *)((char *)gpio_map + align));
-        if (!new_priv)
-            return -1;
-        inst->priv = new_priv;
+            inst->map_fd = dev_mem_fd;
+            inst->map_offset = inst->phys_addr - inst->map_align;
+        }
+
+        // Registers can only be mapped from a device (or a sim image)
+        if (!sim_dir &&
+            (fstat(inst->map_fd, &st) != 0 || !S_ISCHR(st.st_mode)))
+            return ENODEV;
+
+        inst->map_state = MAP_PENDING;
     }
 
+    gpios_mmapped = 1;
+    if (thread_safe)
+        gpio_prepare_threads();
     return 0;
 }
 
@@ -765,3 +2781,80 @@ void gpiolib_set_verbose(void (*callback)(const char *))
 {
     verbose_callback = callback;
 }
+
+int gpiolib_set_thread_safe(int enable)
+{
+    thread_safe = enable;
+    if (thread_safe && gpios_mmapped)
+        gpio_prepare_threads();
+    return 0;
+}
+
+void gpiolib_set_shadow(int enable)
+{
+    unsigned i;
+
+    shadow_enabled = enable;
+    if (enable)
+        return;
+
+    /* Nothing written from now on is recorded, so a shadow kept until it is
+     * enabled again would be out of date - drop them all.
+     */
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        free(gpio_chips[i].shadow);
+        gpio_chips[i].shadow = NULL;
+    }
+}
+
+int gpio_resync(void)
+{
+    unsigned i;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+
+        if (inst->shadow && gpio_chip_ready(inst) == 0)
+            gpio_shadow_read(inst, 0, inst->num_gpios);
+    }
+
+    return 0;
+}
+
+static atomic_uint *gpio_reg_lock_for(volatile uint32_t *reg)
+{
+    uintptr_t word = (uintptr_t)reg / sizeof(uint32_t);
+
+    // Registers are often used in runs, so keep neighbours apart
+    return &reg_locks[(word ^ (word / NUM_REG_LOCKS)) % NUM_REG_LOCKS];
+}
+
+int gpio_regs_simulated(void)
+{
+    return sim_dir != NULL;
+}
+
+void gpio_reg_lock(volatile uint32_t *reg)
+{
+    atomic_uint *lock;
+
+    if (!thread_safe)
+        return;
+
+    lock = gpio_reg_lock_for(reg);
+    while (atomic_exchange_explicit(lock, 1, memory_order_acquire))
+    {
+        while (atomic_load_explicit(lock, memory_order_relaxed))
+            continue;
+    }
+}
+
+void gpio_reg_unlock(volatile uint32_t *reg)
+{
+    if (!thread_safe)
+        return;
+
+    atomic_store_explicit(gpio_reg_lock_for(reg), 0, memory_order_release);
+}
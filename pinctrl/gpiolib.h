@@ -54,32 +54,151 @@ typedef enum
     DRIVE_MAX
 } GPIO_DRIVE_T;
 
+typedef enum
+{
+    STRENGTH_2MA,
+    STRENGTH_4MA,
+    STRENGTH_8MA,
+    STRENGTH_12MA,
+    STRENGTH_MAX
+} GPIO_STRENGTH_T;
+
+typedef enum
+{
+    SLEW_SLOW,
+    SLEW_FAST,
+    SLEW_MAX
+} GPIO_SLEW_T;
+
+typedef enum
+{
+    SCHMITT_OFF,
+    SCHMITT_ON,
+    SCHMITT_MAX
+} GPIO_SCHMITT_T;
+
+typedef struct
+{
+    uint8_t fsel;   /* GPIO_FSEL_T */
+    uint8_t dir;    /* GPIO_DIR_T */
+    uint8_t drive;  /* GPIO_DRIVE_T */
+    uint8_t pull;   /* GPIO_PULL_T */
+    int8_t level;   /* 1, 0, or -1 if unknown */
+} GPIO_PIN_STATE_T;
+
+typedef struct
+{
+    uint8_t fsel;   /* GPIO_FSEL_T, or GPIO_FSEL_MAX to leave it alone */
+    uint8_t dir;    /* GPIO_DIR_T, or DIR_MAX */
+    uint8_t drive;  /* GPIO_DRIVE_T, or DRIVE_MAX */
+    uint8_t pull;   /* GPIO_PULL_T, or PULL_MAX */
+    int32_t pad;    /* Raw pad control bits, or -1 */
+} GPIO_PIN_CONFIG_T;
+
+typedef struct
+{
+    uint8_t strength;   /* GPIO_STRENGTH_T, or STRENGTH_MAX to leave it alone */
+    uint8_t slew;       /* GPIO_SLEW_T, or SLEW_MAX */
+    uint8_t schmitt;    /* GPIO_SCHMITT_T, or SCHMITT_MAX */
+} GPIO_PAD_CTRL_T;
+
+struct GPIO_CHIP_INTERFACE_;
+struct GPIO_SHADOW_;
+
+typedef struct
+{
+    const struct GPIO_CHIP_INTERFACE_ *iface;
+    void *priv;
+    unsigned offset;
+    struct GPIO_SHADOW_ **shadow;   /* The chip's shadow, which may be NULL */
+} GPIO_HANDLE_T;
+
+typedef struct GPIO_GROUP_ GPIO_GROUP_T;
+
+typedef struct
+{
+    uint32_t delay_ns;      /* Since the previous step (or the start) */
+    uint32_t set_mask;      /* Group bits to drive high */
+    uint32_t clear_mask;    /* Group bits to drive low */
+} GPIO_WAVE_STEP_T;
+
+typedef struct
+{
+    unsigned num_steps;     /* Steps played, including repeats */
+    uint32_t min_ns;        /* Lateness of the steps w.r.t. their deadlines */
+    uint32_t mean_ns;
+    uint32_t max_ns;
+    uint32_t p99_ns;
+} GPIO_WAVE_STATS_T;
+
 int gpiolib_init(void);
 int gpiolib_init_by_name(const char *name);
 int gpiolib_mmap(void);
+void gpiolib_set_cache(const char *path);
+void gpiolib_set_dtb(const char *path);
+void gpiolib_set_sim(const char *dir);
 void gpiolib_set_verbose(void (*callback)(const char *));
+int gpiolib_set_thread_safe(int enable);
+void gpiolib_set_shadow(int enable);
+int gpio_resync(void);
 
 int gpio_num_is_valid(unsigned gpio);
 GPIO_DIR_T gpio_get_dir(unsigned gpio);
 void gpio_set_dir(unsigned gpio, GPIO_DIR_T dir);
 GPIO_FSEL_T gpio_get_fsel(unsigned gpio);
 void gpio_set_fsel(unsigned gpio, const GPIO_FSEL_T func);
+void gpio_set_fsel_mask(unsigned gpio_base, uint32_t mask, GPIO_FSEL_T func);
 void gpio_set_drive(unsigned gpio, GPIO_DRIVE_T drv);
 void gpio_set(unsigned gpio);
 void gpio_clear(unsigned gpio);
+void gpio_set_mask(unsigned gpio_base, uint32_t mask);
+void gpio_clear_mask(unsigned gpio_base, uint32_t mask);
+void gpio_toggle_mask(unsigned gpio_base, uint32_t mask);
 int gpio_get_level(unsigned gpio);  /* The actual level observed */
+int gpio_get_levels(unsigned gpio_base, uint32_t mask, uint32_t *levels);
+int gpio_get_dirs(unsigned gpio_base, uint32_t mask, uint32_t *dirs);  /* Set for outputs */
+/* Reads and clears the latched edges. Clearing can upset a driver using the
+ * GPIOs as interrupts, and an edge that arrives between the read and the
+ * clear is lost.
+ */
+int gpio_get_edges(unsigned gpio_base, uint32_t mask, uint32_t *rising,
+                   uint32_t *falling);
 GPIO_DRIVE_T gpio_get_drive(unsigned gpio);  /* What it is being driven as */
 GPIO_PULL_T gpio_get_pull(unsigned gpio);
 void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull);
+void gpio_set_pull_mask(unsigned gpio_base, uint32_t mask, GPIO_PULL_T pull);
+int gpio_get_pad_ctrl(unsigned gpio, GPIO_PAD_CTRL_T *ctrl);
+void gpio_set_pad_ctrl(unsigned gpio, const GPIO_PAD_CTRL_T *ctrl);
+void gpio_set_pad_ctrl_mask(unsigned gpio_base, uint32_t mask,
+                            const GPIO_PAD_CTRL_T *ctrl);
+int gpio_snapshot(unsigned first, unsigned count, GPIO_PIN_STATE_T *states);
+int gpio_get_config(unsigned first, unsigned count, GPIO_PIN_CONFIG_T *configs);
+int gpio_apply_config(unsigned first, unsigned count,
+                      const GPIO_PIN_CONFIG_T *configs);
+
+int gpio_get_handle(unsigned gpio, GPIO_HANDLE_T *handle);
+int gpio_handle_get_level(const GPIO_HANDLE_T *handle);
+void gpio_handle_set_drive(const GPIO_HANDLE_T *handle, GPIO_DRIVE_T drv);
+void gpio_handle_set_dir(const GPIO_HANDLE_T *handle, GPIO_DIR_T dir);
+
+GPIO_GROUP_T *gpio_group_create(const unsigned *gpios, unsigned count);
+void gpio_group_write(GPIO_GROUP_T *group, uint32_t value);
+void gpio_group_update(GPIO_GROUP_T *group, uint32_t set_mask, uint32_t clr_mask);
+uint32_t gpio_group_read(GPIO_GROUP_T *group);
+int gpio_wave_play(GPIO_GROUP_T *group, const GPIO_WAVE_STEP_T *steps,
+                   unsigned num_steps, unsigned repeat, GPIO_WAVE_STATS_T *stats);
+void gpio_group_free(GPIO_GROUP_T *group);
 
 void gpio_get_pin_range(unsigned *first, unsigned *last);
 unsigned gpio_for_pin(int pin);
 int gpio_to_pin(unsigned gpio);
 unsigned gpio_get_gpio_by_name(const char *name, int namelen);
 const char *gpio_get_name(unsigned gpio);
+const char *gpio_get_chardev(unsigned gpio, unsigned *line);
 const char *gpio_get_gpio_fsel_name(unsigned gpio, GPIO_FSEL_T fsel);
 const char *gpio_get_fsel_name(GPIO_FSEL_T fsel);
 const char *gpio_get_pull_name(GPIO_PULL_T pull);
 const char *gpio_get_drive_name(GPIO_DRIVE_T drive);
+const char *gpio_get_strength_name(GPIO_STRENGTH_T strength);
 
 #endif
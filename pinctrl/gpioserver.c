@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gpioserver.h"
+
+#define MAX_CLIENTS 32
+
+static volatile sig_atomic_t server_stop;
+
+static void server_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+static void server_handle(const GPIO_REQUEST_T *req, GPIO_RESPONSE_T *rsp)
+{
+    rsp->status = 0;
+    rsp->count = 0;
+    rsp->value = 0;
+
+    if (req->version != GPIO_SERVER_VERSION)
+    {
+        rsp->status = -1;
+        return;
+    }
+
+    switch (req->op)
+    {
+    case GPIO_REQ_SNAPSHOT:
+        if (req->count > GPIO_SERVER_MAX_STATES ||
+            gpio_snapshot(req->gpio, req->count, rsp->states) != 0)
+        {
+            rsp->status = -1;
+            break;
+        }
+        rsp->count = req->count;
+        break;
+
+    case GPIO_REQ_SET_FSEL:
+    case GPIO_REQ_SET_DIR:
+    case GPIO_REQ_SET_DRIVE:
+    case GPIO_REQ_SET_PULL:
+        if (!gpio_num_is_valid(req->gpio))
+        {
+            rsp->status = -1;
+            break;
+        }
+        if (req->op == GPIO_REQ_SET_FSEL && req->value < GPIO_FSEL_MAX)
+            gpio_set_fsel(req->gpio, (GPIO_FSEL_T)req->value);
+        else if (req->op == GPIO_REQ_SET_DIR && req->value < DIR_MAX)
+            gpio_set_dir(req->gpio, (GPIO_DIR_T)req->value);
+        else if (req->op == GPIO_REQ_SET_DRIVE && req->value < DRIVE_MAX)
+            gpio_set_drive(req->gpio, (GPIO_DRIVE_T)req->value);
+        else if (req->op == GPIO_REQ_SET_PULL && req->value < PULL_MAX)
+            gpio_set_pull(req->gpio, (GPIO_PULL_T)req->value);
+        else
+            rsp->status = -1;
+        break;
+
+    case GPIO_REQ_GET_LEVELS:
+        if (gpio_get_levels(req->gpio, req->mask, &rsp->value) != 0)
+            rsp->status = -1;
+        break;
+
+    case GPIO_REQ_SET_MASK:
+        gpio_set_mask(req->gpio, req->mask);
+        break;
+
+    case GPIO_REQ_CLEAR_MASK:
+        gpio_clear_mask(req->gpio, req->mask);
+        break;
+
+    case GPIO_REQ_TOGGLE_MASK:
+        gpio_toggle_mask(req->gpio, req->mask);
+        break;
+
+    default:
+        rsp->status = -1;
+        break;
+    }
+}
+
+int gpio_serve(const char *path)
+{
+    struct pollfd fds[MAX_CLIENTS + 1];
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    unsigned num_fds, i;
+    int listen_fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Replace a stale socket, but nothing else */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, MAX_CLIENTS) != 0)
+    {
+        printf("Failed to listen on \"%s\" - %s\n", path, strerror(errno));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    num_fds = 1;
+
+    /* A single thread handles every request in turn, so the register
+     * read-modify-writes of different clients can't interleave.
+     */
+    while (!server_stop)
+    {
+        if (poll(fds, num_fds, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = num_fds - 1; i > 0; i--)
+        {
+            GPIO_REQUEST_T req;
+            GPIO_RESPONSE_T rsp;
+            ssize_t len;
+
+            if (!fds[i].revents)
+                continue;
+
+            len = recv(fds[i].fd, &req, sizeof(req), 0);
+            if (len == (ssize_t)sizeof(req))
+            {
+                size_t size;
+
+                server_handle(&req, &rsp);
+                size = GPIO_RESPONSE_SIZE(rsp.count);
+                /* Never wait for a client - one that has stopped reading
+                 * its responses is dropped rather than stalling the rest.
+                 */
+                if (send(fds[i].fd, &rsp, size, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)size)
+                    continue;
+            }
+            else if (len < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            /* Disconnected, or sent something that isn't a request */
+            close(fds[i].fd);
+            fds[i] = fds[--num_fds];
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+            if (fd < 0)
+                continue;
+            if (num_fds > MAX_CLIENTS)
+            {
+                close(fd);
+            }
+            else
+            {
+                fds[num_fds].fd = fd;
+                fds[num_fds].events = POLLIN;
+                fds[num_fds].revents = 0;
+                num_fds++;
+            }
+        }
+    }
+
+    for (i = 1; i < num_fds; i++)
+        close(fds[i].fd);
+    close(listen_fd);
+    unlink(path);
+
+    return 0;
+}
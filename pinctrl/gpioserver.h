@@ -0,0 +1,55 @@
+#ifndef GPIOSERVER_H
+#define GPIOSERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpiolib.h"
+
+/* The pinctrl server protocol. Each request and response is a single
+ * message on a SOCK_SEQPACKET UNIX socket, and every request receives
+ * exactly one response. Requests are fixed-size; responses are truncated
+ * after the count states that they carry (see GPIO_RESPONSE_SIZE).
+ */
+
+#define GPIO_SERVER_VERSION     2
+#define GPIO_SERVER_MAX_STATES  64
+
+typedef enum
+{
+    GPIO_REQ_SNAPSHOT,      /* gpio = first, count -> states */
+    GPIO_REQ_SET_FSEL,      /* gpio, value = GPIO_FSEL_T */
+    GPIO_REQ_SET_DIR,       /* gpio, value = GPIO_DIR_T */
+    GPIO_REQ_SET_DRIVE,     /* gpio, value = GPIO_DRIVE_T */
+    GPIO_REQ_SET_PULL,      /* gpio, value = GPIO_PULL_T */
+    GPIO_REQ_GET_LEVELS,    /* gpio = base, mask -> value */
+    GPIO_REQ_SET_MASK,      /* gpio = base, mask */
+    GPIO_REQ_CLEAR_MASK,    /* gpio = base, mask */
+    GPIO_REQ_TOGGLE_MASK,   /* gpio = base, mask */
+    GPIO_REQ_MAX
+} GPIO_REQUEST_OP_T;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t op;             /* GPIO_REQUEST_OP_T */
+    uint16_t count;
+    uint32_t gpio;
+    uint32_t value;
+    uint32_t mask;
+} GPIO_REQUEST_T;
+
+typedef struct
+{
+    int32_t status;         /* 0 on success, else -1 */
+    uint32_t count;
+    uint32_t value;
+    GPIO_PIN_STATE_T states[GPIO_SERVER_MAX_STATES];
+} GPIO_RESPONSE_T;
+
+#define GPIO_RESPONSE_SIZE(count) \
+    (offsetof(GPIO_RESPONSE_T, states) + (count) * sizeof(GPIO_PIN_STATE_T))
+
+int gpio_serve(const char *path);
+
+#endif
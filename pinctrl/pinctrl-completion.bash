@@ -1,7 +1,7 @@
 _pinctrl ()
 {
     local cur prev words cword split cmd pins pincomp ALLPINS CHIPS chip pinmode=false prefix arg i func pull;
-    local opts="no op ip a0 a1 a2 a3 a4 a5 a6 a7 a8 dh dl pu pd pn ";
+    local opts="no op ip a0 a1 a2 a3 a4 a5 a6 a7 a8 dh dl pu pd pn ds2 ds4 ds8 ds12 slow fast schmitt noschmitt ";
     _init_completion -s || return;
 
     i=1
@@ -10,6 +10,8 @@ _pinctrl ()
         if [[ "$arg" == "-c" ]]; then
             chip=${COMP_WORDS[$((i + 1))]}
             i=$((i + 2))
+        elif [[ "$arg" == "-d" || "$arg" == "-f" ]]; then
+            i=$((i + 2))
         else
             if [[ "$arg" == "-p" ]]; then
                 pinmode=true
@@ -18,9 +20,17 @@ _pinctrl ()
         fi
     done
 
-    if [[ $i -lt $cword && ${COMP_WORDS[$i]} =~ ^(get|set|funcs|poll|help) ]]; then
+    if [[ $i -lt $cword && ${COMP_WORDS[$i]} =~ ^(get|set|funcs|poll|stats|capture|irqstat|save|help) ]]; then
         cmd=${COMP_WORDS[$i]}
         i=$((i + 1))
+        if [[ "$cmd" == "save" ]]; then
+            # The GPIOs follow the file name
+            if [[ $i -lt $cword ]]; then
+                i=$((i + 1))
+            else
+                cmd=""
+            fi
+        fi
     elif [[ ${COMP_WORDS[$i]} =~ ^[A-Z0-9] ]]; then
         cmd="set"
     fi
@@ -46,6 +56,12 @@ _pinctrl ()
             elif [[ $arg =~ ^(pu|pd|pn)$ ]]; then
                 pull=$arg
                 opts=$(echo "$opts" | sed -E "s/(pu|pd|pn) //g")
+            elif [[ $arg =~ ^ds(2|4|8|12)$ ]]; then
+                opts=$(echo "$opts" | sed -E "s/ds(2|4|8|12) //g")
+            elif [[ $arg =~ ^(slow|fast)$ ]]; then
+                opts=$(echo "$opts" | sed -E "s/(slow|fast) //g")
+            elif [[ $arg =~ ^(no)?schmitt$ ]]; then
+                opts=$(echo "$opts" | sed -E "s/(no)?schmitt //g")
             fi
             i=$((i + 1))
         done
@@ -63,16 +79,26 @@ _pinctrl ()
     elif [[ "$cmd" != "" ]]; then
         if [[ "$cmd" == "set" ]]; then
             COMPREPLY+=($(compgen -W "$opts" -- $cur))
+        elif [[ "$cmd" == "capture" ]]; then
+            COMPREPLY+=($(compgen -W "--rate --duration --format -o" -- $cur))
+        elif [[ "$cmd" == "stats" ]]; then
+            COMPREPLY+=($(compgen -W "--interval --count --rate --json" -- $cur))
         fi
     else
-        if [[ "$prev" == "-c" ]]; then
+        if [[ "$prev" == "-d" ]]; then
+            _filedir dtb
+        elif [[ "$prev" =~ ^(-f|wave|save|restore)$ ]]; then
+            _filedir
+        elif [[ "$prev" == "--sim" ]]; then
+            _filedir -d
+        elif [[ "$prev" == "-c" ]]; then
             CHIPS=($(pinctrl -v -p 0 | grep 'gpios)' | cut -d' ' -f4 | sort | uniq))
             chips="${CHIPS[@]}"
             COMPREPLY+=($(compgen -W "$chips" -- $cur))
         elif [[ "$cur" =~ ^- ]]; then
-            COMPREPLY+=($(compgen -W "-p -h -v -c" -- $cur))
+            COMPREPLY+=($(compgen -W "-p -h -v -c -d -e -f --serve --sim" -- $cur))
         elif [[ "$chip" == "" ]]; then
-            COMPREPLY+=($(compgen -W "get set poll funcs help" -- $cur))
+            COMPREPLY+=($(compgen -W "get set poll stats capture irqstat wave save restore funcs help" -- $cur))
         else
             COMPREPLY+=($(compgen -W "funcs help" -- $cur))
         fi
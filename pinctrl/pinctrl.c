@@ -1,14 +1,22 @@
 #define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <linux/gpio.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "gpiolib.h"
+#include "gpioserver.h"
 
 #define ARRAY_SIZE(_a) (sizeof(_a)/sizeof(_a[0]))
 
@@ -17,17 +25,115 @@ const char *program_name = "pinctrl";
 static int pin_mode = 0;
 static int verbose_mode = 0;
 static unsigned num_gpios;
+static const char *named_chip;
+static const char *dtb_file;
+static const char *sim_dir;
+static int echo;
+static int gpios_mapped;
 
 struct poll_gpio_state {
     unsigned int num;
     unsigned int gpio;
     const char *name;
     int level;
+    int event_fd;   /* Line request fd, or -1 */
+    unsigned line;  /* Offset within the kernel gpiochip */
+    /* For stats */
+    unsigned window;
+    uint32_t bit;
+    unsigned rising;
+    unsigned falling;
+    uint64_t high_ns;
+    uint64_t last_change_ns;
+    uint64_t first_rise_ns;
+    uint64_t last_rise_ns;
 };
 
 int num_poll_gpios;
 struct poll_gpio_state *poll_gpios;
 
+static GPIO_PIN_STATE_T gpio_states[MAX_GPIO_PINS];
+
+/* The changes made by "set", filled in by do_gpio_set */
+static GPIO_PIN_CONFIG_T set_configs[MAX_GPIO_PINS];
+static unsigned set_first, set_last;
+static GPIO_PAD_CTRL_T set_pad_ctrl;
+static uint32_t set_pad_mask[(MAX_GPIO_PINS + 31)/32];
+
+/* The edges seen by "irqstat" so far, for scripts that repeat it */
+static unsigned irq_counts[MAX_GPIO_PINS];
+
+/* A line event, matched to the GPIO it came from */
+struct poll_event {
+    struct poll_gpio_state *state;
+    uint64_t timestamp_ns;
+    int level;
+};
+
+#define MAX_READY_REQUESTS 16
+#define MAX_POLL_EVENTS (MAX_READY_REQUESTS * 16)
+
+struct stats_window {
+    unsigned int gpio_base;
+    uint32_t mask;
+    uint32_t levels;
+};
+
+static uint64_t stats_interval_ns = 1000000000;
+static double stats_rate = 1000;    /* Of sampling, without line events */
+static unsigned stats_count;    /* Intervals to report, or 0 for no limit */
+static int stats_json;
+
+/* The file format of "pinctrl save", in native byte order */
+#define CONFIG_MAGIC   "GPCF"
+#define CONFIG_VERSION 1
+
+struct config_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t num_gpios;     /* Of the system it was saved on */
+    uint32_t num_records;
+};
+
+struct config_record {
+    uint16_t gpio;
+    uint8_t fsel;
+    uint8_t dir;
+    uint8_t drive;
+    uint8_t pull;
+    uint8_t has_pad;
+    uint8_t reserved;
+    uint32_t pad;
+};
+
+#define CAPTURE_MAX_BYTES (512 * 1024 * 1024)
+#define CAPTURE_MAX_DROPS 8
+
+struct capture_channel {
+    unsigned int num;
+    unsigned int gpio;
+    const char *name;
+    unsigned int window;
+    unsigned int bit;
+};
+
+struct capture_window {
+    unsigned int gpio_base;
+    uint32_t mask;
+};
+
+struct capture_drop {
+    uint64_t sample;
+    uint64_t count;
+};
+
+static int num_capture_channels;
+static struct capture_channel *capture_channels;
+static double capture_rate = 1000000;
+static uint64_t capture_duration_ns = 1000000000;
+static const char *capture_file;
+static int capture_sigrok;
+
 static void print_gpio_alts_info(unsigned gpio)
 {
     const char *name;
@@ -78,12 +184,35 @@ static void usage(void)
     printf("OR\n");
     printf("  %s [-p] [-v] poll <GPIO>\n", name);
     printf("OR\n");
+    printf("  %s [-p] [-v] stats <GPIO> [--interval <time>] [--count <n>] [--rate <Hz>] [--json]\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [-v] capture <GPIO> [--rate <Hz>] [--duration <time>]\n", name);
+    printf("          [--format vcd|sigrok] [-o <file>]\n");
+    printf("OR\n");
+    printf("  %s [-p] [-v] wave <file>\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [-v] save <file> [GPIO]\n", name);
+    printf("OR\n");
+    printf("  %s [-v] restore <file>\n", name);
+    printf("OR\n");
     printf("  %s [-p] [-v] funcs [GPIO]\n", name);
     printf("OR\n");
     printf("  %s [-p] [-v] lev [GPIO]\n", name);
     printf("OR\n");
+    printf("  %s [-p] [-v] irqstat [GPIO]\n", name);
+    printf("OR\n");
     printf("  %s -c <chip> [funcs] [GPIO]\n", name);
     printf("OR\n");
+    printf("  %s -d <dtb> [-p] [-v] [funcs] [GPIO]\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [-v] [-e] -f <script>\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [-v] [-e] -\n", name);
+    printf("OR\n");
+    printf("  %s --serve <socket>\n", name);
+    printf("OR\n");
+    printf("  %s --sim <dir> [-c <chip> | -d <dtb>] [-p] [-v] [-e] [command]\n", name);
+    printf("OR\n");
     printf("  %s -l\n", name);
     printf("\n");
     printf("GPIO is a comma-separated list of GPIO names, numbers or ranges (without\n");
@@ -93,11 +222,50 @@ static void usage(void)
     printf("If the -p option is given, GPIO numbers are replaced by pin numbers on the\n");
     printf("40-way header. If the -v option is given, the output is more verbose. Including\n");
     printf("the -e option in a \"set\" causes pinctrl to echo back the new pin states.\n");
+    printf("With -v, \"get\" also shows the pad drive strength, slew rate and schmitt\n");
+    printf("trigger of chips that have them (RP1).\n");
     printf("%s funcs will dump all the possible GPIO alt functions in CSV format\n", name);
     printf("or if [GPIO] is specified the alternate funcs just for that specific GPIO.\n");
     printf("The -c option allows the alt functions (and only the alt function) for a named\n");
     printf("chip to be displayed, even if that chip is not present in the current system.\n");
+    printf("The -d option reads the GPIO chips and names from a saved Device Tree (a\n");
+    printf("directory like /proc/device-tree, or a .dtb file if built with libfdt)\n");
+    printf("instead of the running system, so only \"funcs\" and -l can be used.\n");
     printf("The -l option lists the discovered chips.\n");
+    printf("The --sim option uses register images in the given directory instead of the\n");
+    printf("hardware, so that any command can be run off-target. With -c or -d it\n");
+    printf("simulates that chip or board.\n");
+    printf("The -f option runs the get, set, level, irqstat and funcs commands in a script\n");
+    printf("file (or stdin, if the file is \"-\"), one per line, as well as \"wait <us>\"\n");
+    printf("commands. Text after a # is ignored. The GPIOs are only mapped once, and\n");
+    printf("with -v each command is followed by its line number and time taken.\n");
+    printf("The --serve option keeps the GPIOs mapped and serves requests from\n");
+    printf("gpioclient library users on the given UNIX socket, one at a time.\n");
+    printf("%s poll waits for kernel GPIO line events when the GPIOs are inputs,\n", name);
+    printf("otherwise it continuously samples their levels.\n");
+    printf("%s stats counts the rising and falling edges of the GPIOs, using line\n", name);
+    printf("events or level sampling as poll does, and prints them with the duty\n");
+    printf("cycle and frequency every interval (default 1s), optionally as JSON.\n");
+    printf("Without line events the levels are sampled at --rate (default 1k).\n");
+    printf("%s irqstat prints the GPIOs (default all) that have latched a rising\n", name);
+    printf("or falling edge since the last read, then clears them, with a running count.\n");
+    printf("It is only supported on RP1, and clearing the latches can upset a Linux\n");
+    printf("driver using those GPIOs as interrupts. An edge arriving between the\n");
+    printf("read and the clear is cleared without being reported.\n");
+    printf("%s capture samples the GPIOs at a fixed rate (default 1M) for a fixed\n", name);
+    printf("duration (default 1s), reading whole banks at a time, then writes a VCD\n");
+    printf("file (or raw data for \"sigrok-cli -I binary\") to the file or stdout.\n");
+    printf("%s wave plays a list of timed steps on a group of GPIOs from a file,\n", name);
+    printf("on a real-time thread that sleeps until just before each step, then\n");
+    printf("prints the timing error. The file has a \"gpios <GPIO>\" line (the first\n");
+    printf("GPIO is bit 0), an optional \"repeat <n>\" line and\n");
+    printf("\"<delay> <set mask> <clear mask>\" step lines.\n");
+    printf("%s save writes the function, direction, drive, pull and pad settings\n", name);
+    printf("of the GPIOs (default all) to a file, and %s restore reapplies them,\n", name);
+    printf("only writing the registers that differ.\n");
+    printf("If PINCTRL_CACHE is set to a file path, the discovered GPIO chips are cached\n");
+    printf("there until the next reboot or overlay change, making later invocations\n");
+    printf("start faster.\n");
     printf("\n");
     printf("Valid [options] for %s set are:\n", name);
     printf("  ip      set GPIO as input\n");
@@ -109,6 +277,10 @@ static void usage(void)
     printf("  pn      set GPIO pull none (no pull)\n");
     printf("  dh      set GPIO to drive high (1) level (only valid if set to be an output)\n");
     printf("  dl      set GPIO to drive low (0) level (only valid if set to be an output)\n");
+    printf("  ds2-ds12 set GPIO pad drive strength to 2, 4, 8 or 12mA (RP1 only)\n");
+    printf("  slow    set GPIO pad to slow slew rate (RP1 only)\n");
+    printf("  fast    set GPIO pad to fast slew rate (RP1 only)\n");
+    printf("  schmitt set GPIO pad input schmitt trigger on (noschmitt - off) (RP1 only)\n");
     printf("Examples:\n");
     printf("  %s get              Prints state of all GPIOs one per line\n", name);
     printf("  %s get 10           Prints state of GPIO10\n", name);
@@ -121,13 +293,45 @@ static void usage(void)
     printf("  %s set 10 ip pd     Set GPIO10 to input with pull down\n", name);
     printf("  %s set 35 a1 pu     Set GPIO35 to fsel 1 (jtag_2_clk) with pull up\n", name);
     printf("  %s set 20 op pn dh  Set GPIO20 to output with no pull and driving high\n", name);
+    printf("  %s set 20 ds2 slow  Make GPIO20 a weak 2mA output with a slow slew rate\n", name);
     printf("  %s lev 4            Prints the level (1 or 0) of GPIO4\n", name);
+    printf("  %s irqstat 4-7      Prints which of GPIO4-7 have changed since the last irqstat\n", name);
+    printf("  %s capture 2,3 --rate 2M --duration 100ms -o i2c.vcd\n", name);
+    printf("                          Captures GPIOs 2 and 3 to i2c.vcd\n");
     printf("  %s -c bcm2835 9-11  Display the alt functions for GPIOs 9-11 on bcm2835\n", name);
     printf("  %s -l               List the compatible detected GPIO chips\n", name);
 }
 
+static void snapshot_gpios(const uint32_t *gpiomask, unsigned start_pin,
+                           unsigned end_pin)
+{
+    unsigned first = MAX_GPIO_PINS, last = 0;
+    unsigned pin;
+
+    for (pin = start_pin; pin < end_pin + 1; pin++)
+    {
+        unsigned gpio = pin;
+
+        if (!(gpiomask[pin / 32] & (1 << (pin % 32))))
+            continue;
+        if (pin_mode)
+            gpio = gpio_for_pin(pin);
+        if (!gpio_num_is_valid(gpio))
+            continue;
+        if (gpio < first)
+            first = gpio;
+        if (gpio > last)
+            last = gpio;
+    }
+
+    if (first <= last)
+        gpio_snapshot(first, last + 1 - first, &gpio_states[first]);
+}
+
 static int do_gpio_get(unsigned int gpio)
 {
+    GPIO_PAD_CTRL_T pad_ctrl;
+    GPIO_PIN_STATE_T *state;
     unsigned int num = gpio;
     const char *name;
     int fsel;
@@ -153,10 +357,12 @@ static int do_gpio_get(unsigned int gpio)
     if (!gpio_num_is_valid(gpio))
         return 1;
 
-    fsel = gpio_get_fsel(gpio);
+    /* Render from the snapshot taken by snapshot_gpios */
+    state = &gpio_states[gpio];
+    fsel = state->fsel;
     printf("%2d: %2s ", num, gpio_get_fsel_name(fsel));
     if (fsel == GPIO_FSEL_OUTPUT)
-        printf("%s", gpio_get_drive_name(gpio_get_drive(gpio)));
+        printf("%s", gpio_get_drive_name(state->drive));
     else
         printf("  ");
 
@@ -164,20 +370,30 @@ static int do_gpio_get(unsigned int gpio)
     if (pin_mode && strchr(name, '/'))
         name = strchr(name, '/') + 1;
 
-    level = gpio_get_level(gpio);
+    level = state->level;
 
-    printf(" %s | %s // %s%s%s\n",
-           gpio_get_pull_name(gpio_get_pull(gpio)),
+    printf(" %s | %s // %s%s%s",
+           gpio_get_pull_name(state->pull),
            (level == 1) ? "hi" : (level == 0) ? "lo" : "--",
            name ? name : "",
            name ? " = " : "",
            gpio_get_gpio_fsel_name(gpio, fsel));
 
+    if (verbose_mode && gpio_get_pad_ctrl(gpio, &pad_ctrl) == 0)
+        printf(" (%s %s%s)", gpio_get_strength_name(pad_ctrl.strength),
+               (pad_ctrl.slew == SLEW_FAST) ? "fast" : "slow",
+               (pad_ctrl.schmitt == SCHMITT_ON) ? " schmitt" : "");
+    printf("\n");
+
     return 0;
 }
 
-static int do_gpio_set(unsigned int gpio, int fsparam, int drive, int pull)
+/* Add a GPIO to the changes made by apply_gpio_sets */
+static int do_gpio_set(unsigned int gpio, int fsparam, int drive, int pull,
+                       const GPIO_PAD_CTRL_T *pad_ctrl)
 {
+    GPIO_PIN_CONFIG_T *config;
+    GPIO_PAD_CTRL_T cur_pad_ctrl;
     unsigned int num = gpio;
 
     if (pin_mode)
@@ -193,16 +409,21 @@ static int do_gpio_set(unsigned int gpio, int fsparam, int drive, int pull)
     if (!gpio_num_is_valid(gpio))
         return 1;
 
-    if (fsparam != GPIO_FSEL_MAX)
-        gpio_set_fsel(gpio, fsparam);
-    else
+    config = &set_configs[gpio];
+    if (gpio < set_first)
+        set_first = gpio;
+    if (gpio > set_last)
+        set_last = gpio;
+
+    config->fsel = fsparam;
+    if (fsparam == GPIO_FSEL_MAX)
         fsparam = gpio_get_fsel(gpio);
 
     if (drive != DRIVE_MAX)
     {
         if (fsparam == GPIO_FSEL_OUTPUT)
         {
-            gpio_set_drive(gpio, drive);
+            config->drive = drive;
         }
         else
         {
@@ -211,12 +432,59 @@ static int do_gpio_set(unsigned int gpio, int fsparam, int drive, int pull)
         }
     }
 
-    if (pull != PULL_MAX)
-        gpio_set_pull(gpio, pull);
+    config->pull = pull;
+
+    if (pad_ctrl->strength != STRENGTH_MAX || pad_ctrl->slew != SLEW_MAX ||
+        pad_ctrl->schmitt != SCHMITT_MAX)
+    {
+        if (gpio_get_pad_ctrl(gpio, &cur_pad_ctrl) != 0)
+        {
+            printf("Can't set drive strength, slew or schmitt on %s\n",
+                   gpio_get_name(gpio));
+            return 1;
+        }
+        set_pad_ctrl = *pad_ctrl;
+        set_pad_mask[gpio / 32] |= 1U << (gpio % 32);
+    }
 
     return 0;
 }
 
+static void reset_gpio_sets(void)
+{
+    unsigned gpio;
+
+    for (gpio = 0; gpio < MAX_GPIO_PINS; gpio++)
+    {
+        set_configs[gpio].fsel = GPIO_FSEL_MAX;
+        set_configs[gpio].dir = DIR_MAX;
+        set_configs[gpio].drive = DRIVE_MAX;
+        set_configs[gpio].pull = PULL_MAX;
+        set_configs[gpio].pad = -1;
+    }
+    set_first = MAX_GPIO_PINS;
+    set_last = 0;
+    memset(set_pad_mask, 0, sizeof(set_pad_mask));
+}
+
+/* Make the changes for all of the GPIOs together, so that each register is
+ * written at most once where the chip allows it.
+ */
+static void apply_gpio_sets(void)
+{
+    unsigned gpio;
+
+    if (set_first <= set_last)
+        gpio_apply_config(set_first, set_last + 1 - set_first,
+                          &set_configs[set_first]);
+
+    for (gpio = 0; gpio < MAX_GPIO_PINS; gpio++)
+    {
+        if (set_pad_mask[gpio / 32] & (1U << (gpio % 32)))
+            gpio_set_pad_ctrl(gpio, &set_pad_ctrl);
+    }
+}
+
 static int do_gpio_level(unsigned int gpio)
 {
     unsigned int num = gpio;
@@ -259,6 +527,30 @@ static int do_gpio_level(unsigned int gpio)
     return 0;
 }
 
+static int do_gpio_irqstat(unsigned int gpio)
+{
+    unsigned int num = gpio;
+    uint32_t rising, falling;
+
+    if (pin_mode)
+        gpio = gpio_for_pin(num);
+
+    if (!gpio_num_is_valid(gpio))
+        return 0;
+
+    if (gpio_get_edges(gpio, 1, &rising, &falling) != 0)
+        return -1;
+    if (!rising && !falling)
+        return 0;
+
+    irq_counts[gpio] += rising + falling;
+    printf("%2d: %s%s%s (%u) // %s\n", num,
+           rising ? "rise" : "", (rising && falling) ? " " : "",
+           falling ? "fall" : "", irq_counts[gpio], gpio_get_name(gpio));
+
+    return 0;
+}
+
 static int do_gpio_poll_add(unsigned int gpio)
 {
     struct poll_gpio_state *new_gpio;
@@ -277,11 +569,219 @@ static int do_gpio_poll_add(unsigned int gpio)
     new_gpio->gpio = gpio;
     new_gpio->name = gpio_get_name(gpio);
     new_gpio->level = -1; /* Unknown */
+    new_gpio->event_fd = -1;
     num_poll_gpios++;
 
     return 0;
 }
 
+static void close_poll_events(void)
+{
+    int i, j;
+
+    for (i = 0; i < num_poll_gpios; i++)
+    {
+        int fd = poll_gpios[i].event_fd;
+
+        if (fd < 0)
+            continue;
+        for (j = i; j < num_poll_gpios; j++)
+        {
+            if (poll_gpios[j].event_fd == fd)
+                poll_gpios[j].event_fd = -1;
+        }
+        close(fd);
+    }
+}
+
+static int open_poll_events(int epoll_fd)
+{
+    int i, j;
+
+    for (i = 0; i < num_poll_gpios; i++)
+    {
+        struct poll_gpio_state *state = &poll_gpios[i];
+        struct gpio_v2_line_request req;
+        struct epoll_event ev;
+        const char *chardev;
+        int members[GPIO_V2_LINES_MAX];
+        int chip_fd, ret;
+
+        if (state->event_fd >= 0)
+            continue;
+
+        /*
+         * Requesting a line makes it a GPIO input, so only do it for pins
+         * which already are to avoid disturbing anything.
+         */
+        if (gpio_get_fsel(state->gpio) != GPIO_FSEL_INPUT)
+            return -1;
+
+        chardev = gpio_get_chardev(state->gpio, &state->line);
+        if (!chardev)
+            return -1;
+
+        memset(&req, 0, sizeof(req));
+        strcpy(req.consumer, program_name);
+        req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                           GPIO_V2_LINE_FLAG_EDGE_RISING |
+                           GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+        /*
+         * Gather the lines on the same chip into one request - any beyond
+         * GPIO_V2_LINES_MAX are left for another.
+         */
+        for (j = i; j < num_poll_gpios && req.num_lines < GPIO_V2_LINES_MAX; j++)
+        {
+            struct poll_gpio_state *other = &poll_gpios[j];
+            unsigned line;
+
+            if (other->event_fd < 0 &&
+                gpio_get_chardev(other->gpio, &line) == chardev)
+            {
+                other->line = line;
+                members[req.num_lines] = j;
+                req.offsets[req.num_lines++] = line;
+            }
+        }
+
+        chip_fd = open(chardev, O_RDONLY | O_CLOEXEC);
+        if (chip_fd < 0)
+            return -1;
+        ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+        close(chip_fd);
+        if (ret < 0)
+            return -1;
+
+        for (j = 0; j < (int)req.num_lines; j++)
+            poll_gpios[members[j]].event_fd = req.fd;
+
+        ev.events = EPOLLIN;
+        ev.data.fd = req.fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, req.fd, &ev) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int compare_poll_events(const void *a, const void *b)
+{
+    const struct poll_event *ea = a, *eb = b;
+
+    return (ea->timestamp_ns > eb->timestamp_ns) - (ea->timestamp_ns < eb->timestamp_ns);
+}
+
+/*
+ * Wait up to timeout_ms (or forever if negative) for line events, and read
+ * those of every request that has some. Each request (i.e. chip or bank)
+ * has its own queue, so the events are merged into timestamp order.
+ * Returns the number of events, 0 on a timeout or signal, or -1.
+ */
+static int read_poll_events(int epoll_fd, int timeout_ms,
+                            struct poll_event *out)
+{
+    struct epoll_event ready[MAX_READY_REQUESTS];
+    struct gpio_v2_line_event events[16];
+    int num_out = 0;
+    int num_ready, r, n, i;
+
+    num_ready = epoll_wait(epoll_fd, ready, MAX_READY_REQUESTS, timeout_ms);
+    if (num_ready < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    for (r = 0; r < num_ready; r++)
+    {
+        int fd = ready[r].data.fd;
+        ssize_t len = read(fd, events, sizeof(events));
+
+        for (n = 0; n < (int)(len / (ssize_t)sizeof(events[0])); n++)
+        {
+            for (i = 0; i < num_poll_gpios; i++)
+            {
+                if (poll_gpios[i].event_fd == fd &&
+                    poll_gpios[i].line == events[n].offset)
+                    break;
+            }
+            if (i == num_poll_gpios)
+                continue;
+
+            out[num_out].state = &poll_gpios[i];
+            out[num_out].timestamp_ns = events[n].timestamp_ns;
+            out[num_out].level = (events[n].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+            num_out++;
+        }
+    }
+
+    qsort(out, num_out, sizeof(*out), compare_poll_events);
+    return num_out;
+}
+
+static int do_gpio_poll_events(void)
+{
+    struct poll_event events[MAX_POLL_EVENTS];
+    uint64_t last_timestamp = 0;
+    int epoll_fd;
+    int i;
+
+    if (!num_poll_gpios)
+        return 0;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return -1;
+
+    if (open_poll_events(epoll_fd) < 0)
+    {
+        close_poll_events();
+        close(epoll_fd);
+        return -1;
+    }
+
+    if (verbose_mode)
+        printf("Waiting for line events\n");
+
+    for (i = 0; i < num_poll_gpios; i++)
+    {
+        struct poll_gpio_state *state = &poll_gpios[i];
+        state->level = gpio_get_level(state->gpio);
+        printf("%2d: %s // %s\n", state->num,
+               (state->level == 1) ? "hi" : (state->level == 0) ? "lo" : "--",
+               state->name);
+    }
+    fflush(stdout);
+
+    while (1)
+    {
+        int num_events = read_poll_events(epoll_fd, -1, events);
+        int n;
+
+        if (num_events < 0)
+            break;
+
+        for (n = 0; n < num_events; n++)
+        {
+            struct poll_gpio_state *state = events[n].state;
+
+            /* An edge queued on another chip can still turn up after a
+             * later one has been printed, so the interval may be negative.
+             */
+            if (last_timestamp)
+                printf("%+" PRId64 "ns\n",
+                       (int64_t)(events[n].timestamp_ns - last_timestamp));
+            last_timestamp = events[n].timestamp_ns;
+
+            state->level = events[n].level;
+            printf("%2d: %s // %s\n", state->num, state->level ? "hi" : "lo", state->name);
+        }
+        fflush(stdout);
+    }
+
+    close_poll_events();
+    close(epoll_fd);
+    return 0;
+}
+
 static void do_gpio_poll(void)
 {
     unsigned int idle_count = 0;
@@ -324,104 +824,975 @@ static void do_gpio_poll(void)
     }
 }
 
-static void verbose_callback(const char *msg)
+static uint64_t stats_now_ns(void)
 {
-    printf("%s", msg);
+    struct timespec ts;
+
+    /* The clock used for line event timestamps */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-int main(int argc, char *argv[])
+static void stats_reset(uint64_t now)
 {
-    int ret;
+    int i;
 
-    /* arg parsing */
+    for (i = 0; i < num_poll_gpios; i++)
+    {
+        struct poll_gpio_state *state = &poll_gpios[i];
+
+        state->rising = 0;
+        state->falling = 0;
+        state->high_ns = 0;
+        state->last_change_ns = now;
+        state->first_rise_ns = 0;
+        state->last_rise_ns = 0;
+    }
+}
 
-    const char *named_chip = NULL;
+static void stats_edge(struct poll_gpio_state *state, int level, uint64_t now)
+{
+    if (level == state->level)
+        return;
+    if (now < state->last_change_ns)
+        now = state->last_change_ns;
 
-    int set = 0;
-    int get = 0;
-    int level = 0;
-    int poll = 0;
-    int funcs = 0;
-    int echo = 0;
-    int list = 0;
-    int pull = PULL_MAX;
-    int infer_cmd = 0;
-    int fsparam = GPIO_FSEL_MAX;
-    int drive = DRIVE_MAX;
-    uint32_t gpiomask[(MAX_GPIO_PINS + 31)/32] = { 0 };
-    unsigned start_pin = GPIO_INVALID, end_pin, pin;
-    int first_pin = 1;
+    if (state->level == 1)
+        state->high_ns += now - state->last_change_ns;
+    if (level && state->level == 0)
+    {
+        if (!state->rising++)
+            state->first_rise_ns = now;
+        state->last_rise_ns = now;
+    }
+    else if (!level && state->level == 1)
+    {
+        state->falling++;
+    }
+    state->level = level;
+    state->last_change_ns = now;
+}
+
+static void stats_report(uint64_t start, uint64_t end, uint64_t elapsed)
+{
+    uint64_t interval = end - start;
     int i;
 
-    argv++;
-    argc--;
+    if (stats_json)
+        printf("{\"time\":%.3f,\"%s\":[", elapsed / 1e9, pin_mode ? "pins" : "gpios");
+    else
+        printf("[%.3fs]\n", elapsed / 1e9);
 
-    while (argc && (argv[0][0] == '-'))
+    for (i = 0; i < num_poll_gpios; i++)
     {
-        const char *arg = *(argv++);
-        argc--;
+        struct poll_gpio_state *state = &poll_gpios[i];
+        double duty, freq;
 
-        if (strcmp(arg, "-c") == 0)
+        if (state->level == 1 && end > state->last_change_ns)
+            state->high_ns += end - state->last_change_ns;
+
+        /* Measure between rising edges where possible, for slow signals */
+        duty = (double)state->high_ns / interval;
+        if (state->rising >= 2 && state->last_rise_ns > state->first_rise_ns)
+            freq = (state->rising - 1) * 1e9 / (state->last_rise_ns - state->first_rise_ns);
+        else
+            freq = state->rising * 1e9 / interval;
+
+        if (stats_json)
+            printf("%s{\"%s\":%u,\"name\":\"%s\",\"rising\":%u,\"falling\":%u,"
+                   "\"duty\":%.4f,\"freq\":%.3f}",
+                   i ? "," : "", pin_mode ? "pin" : "gpio", state->num,
+                   state->name ? state->name : "", state->rising, state->falling,
+                   duty, freq);
+        else
+            printf("%2d: %8u rising %8u falling %6.2f%% high %12.3f Hz // %s\n",
+                   state->num, state->rising, state->falling, duty * 100, freq,
+                   state->name ? state->name : "");
+    }
+
+    if (stats_json)
+        printf("]}\n");
+    fflush(stdout);
+    stats_reset(end);
+}
+
+static int do_gpio_stats_events(void)
+{
+    struct poll_event events[MAX_POLL_EVENTS];
+    uint64_t start, next, now;
+    unsigned reports = 0;
+    int epoll_fd;
+    int i;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return -1;
+
+    if (open_poll_events(epoll_fd) < 0)
+    {
+        close_poll_events();
+        close(epoll_fd);
+        return -1;
+    }
+
+    if (verbose_mode)
+        printf("Counting line events\n");
+
+    start = stats_now_ns();
+    for (i = 0; i < num_poll_gpios; i++)
+        poll_gpios[i].level = gpio_get_level(poll_gpios[i].gpio);
+    stats_reset(start);
+    next = start + stats_interval_ns;
+
+    while (!stats_count || reports < stats_count)
+    {
+        int num_events;
+        int n;
+
+        now = stats_now_ns();
+        if (now >= next)
         {
-            if (!argc)
+            stats_report(next - stats_interval_ns, next, next - start);
+            next += stats_interval_ns;
+            reports++;
+            continue;
+        }
+
+        num_events = read_poll_events(epoll_fd, (int)((next - now + 999999) / 1000000),
+                                      events);
+        if (num_events < 0)
+            break;
+
+        for (n = 0; n < num_events; n++)
+        {
+            /* An edge may have arrived after the end of the interval, while
+             * the events were being read, so report that interval first. One
+             * queued on another chip may still turn up after a later edge
+             * has closed its interval, and then counts in the current one.
+             */
+            while (events[n].timestamp_ns >= next &&
+                   (!stats_count || reports < stats_count))
             {
-                printf("* chip name expected - use 'pinctrl -h' for help\n");
-                return -1;
+                stats_report(next - stats_interval_ns, next, next - start);
+                next += stats_interval_ns;
+                reports++;
             }
-            named_chip = *(argv++);
-            argc--;
+            if (stats_count && reports >= stats_count)
+                break;
+
+            stats_edge(events[n].state, events[n].level, events[n].timestamp_ns);
         }
-        else if (strcmp(arg, "-e") == 0)
+    }
+
+    close_poll_events();
+    close(epoll_fd);
+    return 0;
+}
+
+static void do_gpio_stats_sampling(void)
+{
+    struct stats_window windows[MAX_GPIO_PINS / 32 + 1];
+    uint64_t period_ns = (uint64_t)(1e9 / stats_rate);
+    uint64_t start, next, now, sample;
+    unsigned num_windows = 0, reports = 0;
+    unsigned w;
+    int i;
+
+    /* Assign each GPIO to a 32-GPIO window, read with one access */
+    for (i = 0; i < num_poll_gpios; i++)
+    {
+        struct poll_gpio_state *state = &poll_gpios[i];
+
+        for (w = 0; w < num_windows; w++)
         {
-            echo = 1;
+            if (state->gpio >= windows[w].gpio_base &&
+                state->gpio < windows[w].gpio_base + 32)
+                break;
         }
-        else if (strcmp(arg, "-h") == 0)
+        if (w == num_windows)
         {
-            usage();
-            return 0;
+            if (num_windows == ARRAY_SIZE(windows))
+                continue;
+            windows[w].gpio_base = state->gpio;
+            windows[w].mask = 0;
+            num_windows++;
         }
-        else if (strcmp(arg, "-l") == 0)
+        state->window = w;
+        state->bit = 1U << (state->gpio - windows[w].gpio_base);
+        windows[w].mask |= state->bit;
+    }
+
+    start = stats_now_ns();
+    for (w = 0; w < num_windows; w++)
+        gpio_get_levels(windows[w].gpio_base, windows[w].mask, &windows[w].levels);
+    for (i = 0; i < num_poll_gpios; i++)
+        poll_gpios[i].level = !!(windows[poll_gpios[i].window].levels & poll_gpios[i].bit);
+    stats_reset(start);
+    next = start + stats_interval_ns;
+    sample = start;
+
+    while (!stats_count || reports < stats_count)
+    {
+        struct timespec ts;
+
+        /* Sleep until the next sample is due, skipping any missed */
+        sample += period_ns ? period_ns : 1;
+        now = stats_now_ns();
+        if (sample > now)
         {
-            list = 1;
-            verbose_mode = 1;
+            ts.tv_sec = sample / 1000000000;
+            ts.tv_nsec = sample % 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+            now = sample;
         }
-        else if (strcmp(arg, "-p") == 0)
+        else
         {
-            pin_mode = 1;
+            sample = now;
         }
-        else if (strcmp(arg, "-v") == 0)
+
+        if (now >= next)
         {
-            verbose_mode = 1;
+            stats_report(next - stats_interval_ns, next, next - start);
+            next += stats_interval_ns;
+            reports++;
         }
-        else
+
+        for (w = 0; w < num_windows; w++)
         {
-            printf("Unknown option '%s' - try \"%s help\"\n",
-                   arg, program_name);
-            exit(1);
+            struct stats_window *window = &windows[w];
+            uint32_t levels, changed;
+
+            if (gpio_get_levels(window->gpio_base, window->mask, &levels) != 0)
+                continue;
+            changed = levels ^ window->levels;
+            window->levels = levels;
+            if (!changed)
+                continue;
+
+            for (i = 0; i < num_poll_gpios; i++)
+            {
+                struct poll_gpio_state *state = &poll_gpios[i];
+
+                if (state->window == w && (changed & state->bit))
+                    stats_edge(state, !!(levels & state->bit), now);
+            }
         }
     }
+}
 
-    if (verbose_mode)
-        gpiolib_set_verbose(&verbose_callback);
+static int do_gpio_stats(void)
+{
+    if (!num_poll_gpios)
+        return 0;
 
-    if (named_chip)
-        ret = gpiolib_init_by_name(named_chip);
+    /* Prefer kernel line events, falling back to sampling the levels */
+    if (do_gpio_stats_events() < 0)
+    {
+        if (verbose_mode)
+            printf("Line events unavailable - sampling levels\n");
+        do_gpio_stats_sampling();
+    }
+
+    return 0;
+}
+
+static int is_option(const char *arg)
+{
+    /* Distinguish trailing options from the "-<gpio>" end of a range */
+    return arg[0] == '-' && (arg[1] == '-' || strcmp(arg, "-o") == 0);
+}
+
+static int parse_rate(const char *arg, double *rate)
+{
+    char *end;
+    double val = strtod(arg, &end);
+
+    if (*end == 'k' || *end == 'K')
+        val *= 1000;
+    else if (*end == 'M')
+        val *= 1000000;
+    if (*end == 'k' || *end == 'K' || *end == 'M')
+        end++;
+    if (strcmp(end, "") != 0 && strcmp(end, "Hz") != 0)
+        return -1;
+    if (val <= 0)
+        return -1;
+    *rate = val;
+    return 0;
+}
+
+static int parse_duration(const char *arg, uint64_t *duration_ns)
+{
+    char *end;
+    double val = strtod(arg, &end);
+
+    if (strcmp(end, "ns") == 0)
+        ;
+    else if (strcmp(end, "us") == 0)
+        val *= 1e3;
+    else if (strcmp(end, "ms") == 0)
+        val *= 1e6;
+    else if (strcmp(end, "s") == 0 || strcmp(end, "") == 0)
+        val *= 1e9;
     else
-        ret = gpiolib_init();
+        return -1;
+    if (val < 1)
+        return -1;
+    *duration_ns = (uint64_t)val;
+    return 0;
+}
 
-    if (ret < 0)
+static uint64_t time_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int do_gpio_capture_add(unsigned int gpio)
+{
+    struct capture_channel *chan;
+    unsigned int num = gpio;
+
+    if (pin_mode)
+        gpio = gpio_for_pin(num);
+
+    if (!gpio_num_is_valid(gpio))
+        return 1;
+
+    capture_channels = reallocarray(capture_channels, num_capture_channels + 1,
+                                    sizeof(*capture_channels));
+    chan = &capture_channels[num_capture_channels];
+    chan->num = num;
+    chan->gpio = gpio;
+    chan->name = gpio_get_name(gpio);
+    num_capture_channels++;
+
+    return 0;
+}
+
+static int compare_unsigned(const void *a, const void *b)
+{
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+    return (x > y) - (x < y);
+}
+
+/* Group the channels into as few 32-GPIO windows as possible */
+static unsigned capture_build_windows(struct capture_window *windows)
+{
+    unsigned *gpios = malloc(num_capture_channels * sizeof(*gpios));
+    unsigned num_windows = 0;
+    int i;
+
+    for (i = 0; i < num_capture_channels; i++)
+        gpios[i] = capture_channels[i].gpio;
+    qsort(gpios, num_capture_channels, sizeof(*gpios), compare_unsigned);
+
+    for (i = 0; i < num_capture_channels; i++)
     {
-        printf("Failed to initialise gpiolib - %d\n", ret);
-        return -1;
+        if (!num_windows || gpios[i] >= windows[num_windows - 1].gpio_base + 32)
+        {
+            windows[num_windows].gpio_base = gpios[i];
+            windows[num_windows].mask = 0;
+            num_windows++;
+        }
     }
+    free(gpios);
 
-    num_gpios = ret;
-    if (!num_gpios)
+    for (i = 0; i < num_capture_channels; i++)
     {
-        printf("No GPIO chips found\n");
+        struct capture_channel *chan = &capture_channels[i];
+        unsigned w;
+
+        for (w = num_windows - 1; windows[w].gpio_base > chan->gpio; w--)
+            ;
+        chan->window = w;
+        chan->bit = chan->gpio - windows[w].gpio_base;
+        windows[w].mask |= 1U << chan->bit;
+    }
+
+    return num_windows;
+}
+
+static void capture_pin_cpu(void)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+
+    /* Keep to the last core, away from most interrupt handling */
+    if (num_cpus > 1)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(num_cpus - 1, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+}
+
+static void capture_write_vcd(FILE *fp, const uint32_t *samples,
+                              uint64_t num_samples, unsigned num_windows,
+                              uint64_t period_ns)
+{
+    const uint32_t *prev = NULL;
+    uint64_t k;
+    int i;
+
+    fprintf(fp, "$version %s capture $end\n", program_name);
+    fprintf(fp, "$timescale 1ns $end\n");
+    fprintf(fp, "$scope module gpio $end\n");
+    for (i = 0; i < num_capture_channels; i++)
+    {
+        const char *p;
+
+        fprintf(fp, "$var wire 1 %c%c ", '!' + (i % 94), '!' + (i / 94));
+        for (p = capture_channels[i].name; *p; p++)
+            fputc(isalnum(*p) ? *p : '_', fp);
+        fprintf(fp, " $end\n");
+    }
+    fprintf(fp, "$upscope $end\n");
+    fprintf(fp, "$enddefinitions $end\n");
+
+    for (k = 0; k < num_samples; k++)
+    {
+        const uint32_t *sample = &samples[k * num_windows];
+
+        if (prev && !memcmp(prev, sample, num_windows * sizeof(*sample)))
+            continue;
+
+        fprintf(fp, "#%" PRIu64 "\n", k * period_ns);
+        for (i = 0; i < num_capture_channels; i++)
+        {
+            const struct capture_channel *chan = &capture_channels[i];
+            uint32_t bit = 1U << chan->bit;
+
+            if (prev && !((prev[chan->window] ^ sample[chan->window]) & bit))
+                continue;
+            fprintf(fp, "%d%c%c\n", !!(sample[chan->window] & bit),
+                    '!' + (i % 94), '!' + (i / 94));
+        }
+        prev = sample;
+    }
+    fprintf(fp, "#%" PRIu64 "\n", num_samples * period_ns);
+}
+
+static void capture_write_sigrok(FILE *fp, const uint32_t *samples,
+                                 uint64_t num_samples, unsigned num_windows)
+{
+    unsigned unit_size = (num_capture_channels + 7) / 8;
+    uint8_t unit[(MAX_GPIO_PINS + 7) / 8];
+    uint64_t k;
+    int i;
+
+    /* Raw logic data, as read by "sigrok-cli -I binary:numchannels=N" */
+    for (k = 0; k < num_samples; k++)
+    {
+        const uint32_t *sample = &samples[k * num_windows];
+
+        memset(unit, 0, unit_size);
+        for (i = 0; i < num_capture_channels; i++)
+        {
+            const struct capture_channel *chan = &capture_channels[i];
+            if (sample[chan->window] & (1U << chan->bit))
+                unit[i / 8] |= 1 << (i % 8);
+        }
+        fwrite(unit, unit_size, 1, fp);
+    }
+}
+
+static int do_gpio_capture(void)
+{
+    struct capture_window windows[MAX_GPIO_PINS];
+    struct capture_drop drops[CAPTURE_MAX_DROPS];
+    uint64_t period_ns, num_samples, num_dropped = 0, k;
+    uint64_t t0, t1, now;
+    unsigned num_windows, num_drops = 0, w;
+    size_t bytes;
+    uint32_t *samples;
+    FILE *fp;
+
+    if (!num_capture_channels)
+        return 0;
+
+    period_ns = (uint64_t)(1e9 / capture_rate);
+    if (!period_ns)
+    {
+        printf("Sample rate too high\n");
+        return 1;
+    }
+
+    num_windows = capture_build_windows(windows);
+    num_samples = capture_duration_ns / period_ns;
+    if (!num_samples)
+        num_samples = 1;
+    if (num_samples > CAPTURE_MAX_BYTES / (num_windows * sizeof(uint32_t)))
+    {
+        printf("Capture too long - reduce the rate or duration\n");
+        return 1;
+    }
+
+    /* Touch and lock the buffer up front so that sampling doesn't fault */
+    bytes = num_samples * num_windows * sizeof(uint32_t);
+    samples = malloc(bytes);
+    if (!samples)
+    {
+        printf("Failed to allocate the capture buffer\n");
+        return 1;
+    }
+    memset(samples, 0, bytes);
+    mlock(samples, bytes);
+
+    capture_pin_cpu();
+
+    t0 = time_now_ns();
+    for (k = 0; k < num_samples; )
+    {
+        uint64_t deadline = t0 + k * period_ns;
+        uint32_t *sample = &samples[k * num_windows];
+        uint64_t slot;
+
+        do
+            now = time_now_ns();
+        while (now < deadline);
+
+        for (w = 0; w < num_windows; w++)
+            gpio_get_levels(windows[w].gpio_base, windows[w].mask, &sample[w]);
+        k++;
+
+        /* Any slots whose time has already passed are lost */
+        slot = (time_now_ns() - t0) / period_ns;
+        if (slot > k && k < num_samples)
+        {
+            if (slot > num_samples)
+                slot = num_samples;
+            if (num_drops < CAPTURE_MAX_DROPS)
+            {
+                drops[num_drops].sample = k;
+                drops[num_drops].count = slot - k;
+            }
+            num_drops++;
+            num_dropped += slot - k;
+            for (; k < slot; k++)
+                memcpy(&samples[k * num_windows], sample, num_windows * sizeof(*sample));
+        }
+    }
+    t1 = time_now_ns();
+
+    fprintf(stderr, "Captured %" PRIu64 " samples in %.6fs - %.0f samples/s (requested %.0f)\n",
+            num_samples - num_dropped, (t1 - t0) / 1e9,
+            (num_samples - num_dropped) * 1e9 / (t1 - t0), capture_rate);
+    if (num_drops)
+    {
+        unsigned i;
+
+        fprintf(stderr, "%" PRIu64 " samples dropped in %u intervals\n",
+                num_dropped, num_drops);
+        for (i = 0; i < num_drops && i < CAPTURE_MAX_DROPS; i++)
+            fprintf(stderr, "  at %.6fs: %" PRIu64 " samples\n",
+                    drops[i].sample * period_ns / 1e9, drops[i].count);
+    }
+
+    fp = capture_file ? fopen(capture_file, "wb") : stdout;
+    if (!fp)
+    {
+        printf("Failed to open '%s'\n", capture_file);
+        free(samples);
+        return 1;
+    }
+
+    if (capture_sigrok)
+        capture_write_sigrok(fp, samples, num_samples, num_windows);
+    else
+        capture_write_vcd(fp, samples, num_samples, num_windows, period_ns);
+
+    if (fp != stdout)
+        fclose(fp);
+    free(samples);
+
+    return 0;
+}
+
+static void verbose_callback(const char *msg)
+{
+    printf("%s", msg);
+}
+
+static int map_gpios(void)
+{
+    int ret;
+
+    if (gpios_mapped)
+        return 0;
+
+    ret = gpiolib_mmap();
+    if (ret)
+    {
+        if (ret == EACCES && geteuid())
+            printf("Must be root (or group 'gpio' on RPiOS)\n");
+        else
+            printf("Failed to mmap gpiolib - %s\n", strerror(ret));
         return -1;
     }
 
+    gpios_mapped = 1;
+    return 0;
+}
+
+static int wave_parse_gpio(const char *arg, unsigned *gpio)
+{
+    char *end;
+    unsigned long num = strtoul(arg, &end, 10);
+
+    if (end == arg || *end)
+        *gpio = gpio_get_gpio_by_name(arg, strlen(arg));
+    else if (pin_mode)
+        *gpio = gpio_for_pin((int)num);
+    else
+        *gpio = (num < num_gpios) ? (unsigned)num : GPIO_INVALID;
+
+    return gpio_num_is_valid(*gpio) ? 0 : -1;
+}
+
+static int wave_parse_gpios(char *arg, unsigned *gpios, unsigned *count)
+{
+    char *item, *range, *save;
+    unsigned from, to;
+
+    /* Unlike other commands the order matters - the first GPIO is bit 0 */
+    for (item = strtok_r(arg, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        range = strchr(item, '-');
+        if (range)
+            *(range++) = '\0';
+        if (wave_parse_gpio(item, &from) != 0 ||
+            (range && wave_parse_gpio(range, &to) != 0))
+        {
+            printf("Unknown GPIO \"%s\"\n", range ? range : item);
+            return -1;
+        }
+        if (!range)
+            to = from;
+
+        while (1)
+        {
+            if (*count == 32)
+            {
+                printf("Too many GPIOs (max 32)\n");
+                return -1;
+            }
+            gpios[(*count)++] = from;
+            if (from == to)
+                break;
+            from += (from < to) ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+static int do_wave(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    GPIO_WAVE_STEP_T *steps = NULL;
+    GPIO_WAVE_STATS_T stats;
+    GPIO_GROUP_T *group = NULL;
+    unsigned gpios[32];
+    unsigned num_gpios_in_wave = 0;
+    unsigned num_steps = 0, max_steps = 0;
+    uint64_t repeat = 1;
+    unsigned line_num = 0;
+    char line[256];
+    unsigned i;
+    int ret = 1;
+
+    if (!fp)
+    {
+        printf("Failed to open \"%s\"\n", filename);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *args[4];
+        int num_args = 0;
+        char *p, *end;
+
+        line_num++;
+        p = strchr(line, '#');
+        if (p)
+            *p = '\0';
+
+        for (p = strtok(line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n"))
+        {
+            if (num_args == (int)ARRAY_SIZE(args))
+                break;
+            args[num_args++] = p;
+        }
+        if (!num_args)
+            continue;
+
+        if (strcmp(args[0], "gpios") == 0 && num_args == 2)
+        {
+            if (wave_parse_gpios(args[1], gpios, &num_gpios_in_wave) != 0)
+                goto bad_line;
+        }
+        else if (strcmp(args[0], "repeat") == 0 && num_args == 2)
+        {
+            repeat = strtoull(args[1], &end, 0);
+            if (*end || !repeat || repeat > UINT32_MAX)
+                goto bad_line;
+        }
+        else if (num_args == 3)
+        {
+            GPIO_WAVE_STEP_T *step;
+            uint64_t set_mask, clear_mask;
+            uint64_t delay_ns = 0;
+
+            if ((strcmp(args[0], "0") != 0 && parse_duration(args[0], &delay_ns) != 0) ||
+                delay_ns > UINT32_MAX)
+                goto bad_line;
+            set_mask = strtoull(args[1], &end, 0);
+            if (*end || set_mask > UINT32_MAX)
+                goto bad_line;
+            clear_mask = strtoull(args[2], &end, 0);
+            if (*end || clear_mask > UINT32_MAX)
+                goto bad_line;
+
+            if (num_steps == max_steps)
+            {
+                max_steps = max_steps ? max_steps * 2 : 64;
+                step = realloc(steps, max_steps * sizeof(*steps));
+                if (!step)
+                {
+                    printf("Out of memory\n");
+                    goto done;
+                }
+                steps = step;
+            }
+            step = &steps[num_steps++];
+            step->delay_ns = (uint32_t)delay_ns;
+            step->set_mask = (uint32_t)set_mask;
+            step->clear_mask = (uint32_t)clear_mask;
+        }
+        else
+        {
+            goto bad_line;
+        }
+    }
+
+    if (!num_gpios_in_wave || !num_steps)
+    {
+        printf("\"%s\" needs a gpios line and at least one step\n", filename);
+        goto done;
+    }
+
+    if (map_gpios() != 0)
+        goto done;
+
+    group = gpio_group_create(gpios, num_gpios_in_wave);
+    if (!group)
+    {
+        printf("Invalid GPIO group (duplicated GPIOs?)\n");
+        goto done;
+    }
+
+    for (i = 0; i < num_gpios_in_wave; i++)
+        gpio_set_fsel(gpios[i], GPIO_FSEL_OUTPUT);
+
+    capture_pin_cpu();
+    if (gpio_wave_play(group, steps, num_steps, (unsigned)repeat, &stats) != 0)
+    {
+        printf("Failed to play the waveform\n");
+        goto done;
+    }
+
+    printf("%u steps, error min/mean/max/p99 %u/%u/%u/%u ns\n",
+           stats.num_steps, stats.min_ns, stats.mean_ns, stats.max_ns,
+           stats.p99_ns);
+    ret = 0;
+    goto done;
+
+bad_line:
+    printf("Invalid line %u of \"%s\"\n", line_num, filename);
+
+done:
+    gpio_group_free(group);
+    free(steps);
+    fclose(fp);
+    return ret;
+}
+
+static int do_save(const char *filename, const uint32_t *gpiomask,
+                   unsigned start_pin, unsigned end_pin)
+{
+    static GPIO_PIN_CONFIG_T configs[MAX_GPIO_PINS];
+    static struct config_record records[MAX_GPIO_PINS];
+    struct config_header header;
+    unsigned num_records = 0;
+    unsigned pin;
+    FILE *fp;
+    int ret = 0;
+
+    if (gpio_get_config(0, num_gpios, configs) != 0)
+        return 1;
+
+    for (pin = start_pin; pin < end_pin + 1; pin++)
+    {
+        struct config_record *record = &records[num_records];
+        unsigned gpio = pin;
+
+        if (!(gpiomask[pin / 32] & (1 << (pin % 32))))
+            continue;
+        if (pin_mode)
+            gpio = gpio_for_pin(pin);
+        if (!gpio_num_is_valid(gpio) || gpio >= num_gpios)
+            continue;
+
+        memset(record, 0, sizeof(*record));
+        record->gpio = gpio;
+        record->fsel = configs[gpio].fsel;
+        record->dir = configs[gpio].dir;
+        record->drive = configs[gpio].drive;
+        record->pull = configs[gpio].pull;
+        record->has_pad = configs[gpio].pad >= 0;
+        record->pad = record->has_pad ? (uint32_t)configs[gpio].pad : 0;
+        num_records++;
+    }
+
+    memcpy(header.magic, CONFIG_MAGIC, sizeof(header.magic));
+    header.version = CONFIG_VERSION;
+    header.num_gpios = num_gpios;
+    header.num_records = num_records;
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        printf("Failed to create \"%s\"\n", filename);
+        return 1;
+    }
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        (num_records &&
+         fwrite(records, sizeof(records[0]), num_records, fp) != num_records))
+        ret = 1;
+    if (fclose(fp) != 0)
+        ret = 1;
+    if (ret)
+        printf("Failed to write \"%s\"\n", filename);
+    else if (verbose_mode)
+        printf("Saved %u GPIOs\n", num_records);
+
+    return ret;
+}
+
+static int do_restore(const char *filename)
+{
+    static GPIO_PIN_CONFIG_T configs[MAX_GPIO_PINS];
+    struct config_header header;
+    struct config_record record;
+    unsigned first = MAX_GPIO_PINS, last = 0;
+    unsigned i;
+    FILE *fp;
+    int ret = 1;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        printf("Failed to open \"%s\"\n", filename);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, CONFIG_MAGIC, sizeof(header.magic)) != 0)
+    {
+        printf("\"%s\" is not a saved pin configuration\n", filename);
+        goto done;
+    }
+    if (header.version != CONFIG_VERSION)
+    {
+        printf("Unsupported configuration version %u\n", header.version);
+        goto done;
+    }
+    if (header.num_gpios != num_gpios)
+    {
+        printf("Configuration was saved on a different system\n");
+        goto done;
+    }
+
+    /* Anything not in the file is left alone */
+    for (i = 0; i < MAX_GPIO_PINS; i++)
+    {
+        configs[i].fsel = GPIO_FSEL_MAX;
+        configs[i].dir = DIR_MAX;
+        configs[i].drive = DRIVE_MAX;
+        configs[i].pull = PULL_MAX;
+        configs[i].pad = -1;
+    }
+
+    for (i = 0; i < header.num_records; i++)
+    {
+        GPIO_PIN_CONFIG_T *config;
+
+        if (fread(&record, sizeof(record), 1, fp) != 1 ||
+            !gpio_num_is_valid(record.gpio) || record.gpio >= num_gpios ||
+            record.fsel > GPIO_FSEL_MAX || record.dir > DIR_MAX ||
+            record.drive > DRIVE_MAX || record.pull > PULL_MAX)
+        {
+            printf("Invalid record %u in \"%s\"\n", i, filename);
+            goto done;
+        }
+
+        config = &configs[record.gpio];
+        config->fsel = record.fsel;
+        config->dir = record.dir;
+        config->drive = record.drive;
+        config->pull = record.pull;
+        config->pad = record.has_pad ? (int32_t)record.pad : -1;
+        if (record.gpio < first)
+            first = record.gpio;
+        if (record.gpio > last)
+            last = record.gpio;
+    }
+
+    if (map_gpios() != 0)
+        goto done;
+
+    ret = 0;
+    if (first <= last &&
+        gpio_apply_config(first, last + 1 - first, &configs[first]) != 0)
+        ret = 1;
+    else if (verbose_mode)
+        printf("Restored %u GPIOs\n", header.num_records);
+
+done:
+    fclose(fp);
+    return ret;
+}
+
+static int do_command(int argc, char *argv[], int in_script)
+{
+    int set = 0;
+    int get = 0;
+    int level = 0;
+    int irqstat = 0;
+    int poll = 0;
+    int stats = 0;
+    int capture = 0;
+    int funcs = 0;
+    int save = 0;
+    const char *save_file = NULL;
+    int pull = PULL_MAX;
+    int infer_cmd = 0;
+    int fsparam = GPIO_FSEL_MAX;
+    int drive = DRIVE_MAX;
+    GPIO_PAD_CTRL_T pad_ctrl = { STRENGTH_MAX, SLEW_MAX, SCHMITT_MAX };
+    uint32_t gpiomask[(MAX_GPIO_PINS + 31)/32] = { 0 };
+    unsigned start_pin = GPIO_INVALID, end_pin, pin;
+    int first_pin = 1;
+    int unsupported = 0;
+    int set_failed = 0;
+    int ret;
+    int i;
+
     if (argc)
     {
         const char *cmd = *(argv++);
@@ -433,13 +1804,49 @@ int main(int argc, char *argv[])
             return 0;
         }
 
+        if (strcmp(cmd, "wave") == 0)
+        {
+            if (argc != 1)
+            {
+                printf("Usage: wave <file>\n");
+                return 1;
+            }
+            return do_wave(argv[0]);
+        }
+
+        if (strcmp(cmd, "restore") == 0)
+        {
+            if (argc != 1)
+            {
+                printf("Usage: restore <file>\n");
+                return 1;
+            }
+            return do_restore(argv[0]);
+        }
+
+        save = strcmp(cmd, "save") == 0;
+        if (save)
+        {
+            if (!argc)
+            {
+                printf("Usage: save <file> [GPIO]\n");
+                return 1;
+            }
+            save_file = *(argv++);
+            argc--;
+        }
+
         get = strcmp(cmd, "get") == 0;
         set = strcmp(cmd, "set") == 0;
         level = strcmp(cmd, "level") == 0 || strcmp(cmd, "lev") == 0;
+        irqstat = strcmp(cmd, "irqstat") == 0;
         poll = strcmp(cmd, "poll") == 0;
+        stats = strcmp(cmd, "stats") == 0;
+        capture = strcmp(cmd, "capture") == 0;
         funcs = strcmp(cmd, "funcs") == 0;
 
-        if (!set && !get && !level && !poll && !funcs)
+        if (!set && !get && !level && !irqstat && !poll && !stats && !capture &&
+            !funcs && !save)
         {
             /* Back up in case we can decode this as a pin */
             argv--;
@@ -447,8 +1854,9 @@ int main(int argc, char *argv[])
             infer_cmd = 1;
         }
     }
-    else if (named_chip)
+    else if ((named_chip || dtb_file) && !sim_dir)
     {
+        /* There is no hardware to get from */
         funcs = 1;
     }
     else
@@ -456,8 +1864,11 @@ int main(int argc, char *argv[])
         get = 1;
     }
 
-    if (list)
-        return 0;
+    if (in_script && (poll || stats || capture))
+    {
+        printf("\"%s\" can't be used in a script\n", argv[-1]);
+        return 1;
+    }
 
     if (pin_mode)
     {
@@ -507,7 +1918,8 @@ int main(int argc, char *argv[])
             }
             p += len;
 
-            if (*p == '\0' && argc && (argv[0][0] == '-' || argv[0][0] == ','))
+            if (*p == '\0' && argc && !is_option(argv[0]) &&
+                (argv[0][0] == '-' || argv[0][0] == ','))
             {
                 p = *(argv++);
                 argc--;
@@ -589,6 +2001,16 @@ int main(int argc, char *argv[])
         printf("Need GPIO number to poll\n");
         return 1;
     }
+    else if (stats)
+    {
+        printf("Need GPIO number to count\n");
+        return 1;
+    }
+    else if (capture)
+    {
+        printf("Need GPIO number to capture\n");
+        return 1;
+    }
 
     if (set && !argc)
     {
@@ -596,7 +2018,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if ((get || funcs) && argc)
+    if ((get || funcs || save || irqstat) && argc)
     {
         printf("Too many arguments\n");
         return 1;
@@ -604,7 +2026,7 @@ int main(int argc, char *argv[])
 
     if (infer_cmd)
     {
-        if (named_chip)
+        if ((named_chip || dtb_file) && !sim_dir)
             funcs = 1;
         else if (argc)
             set = 1;
@@ -618,7 +2040,66 @@ int main(int argc, char *argv[])
         const char *arg = *(argv++);
         argc--;
 
-        if (strcmp(arg, "dh") == 0)
+        if (stats && strcmp(arg, "--json") == 0)
+        {
+            stats_json = 1;
+        }
+        else if ((capture || stats) && is_option(arg))
+        {
+            const char *val = argc ? argv[0] : NULL;
+
+            if (!val)
+            {
+                printf("Missing value for \"%s\"\n", arg);
+                return 1;
+            }
+            argv++;
+            argc--;
+
+            if (stats && strcmp(arg, "--interval") == 0)
+                ret = parse_duration(val, &stats_interval_ns);
+            else if (stats && strcmp(arg, "--rate") == 0)
+                ret = parse_rate(val, &stats_rate);
+            else if (stats && strcmp(arg, "--count") == 0)
+            {
+                char *end;
+                stats_count = strtoul(val, &end, 10);
+                ret = (*end || !stats_count) ? -1 : 0;
+            }
+            else if (stats)
+            {
+                printf("Unknown argument \"%s\"\n", arg);
+                return 1;
+            }
+            else if (strcmp(arg, "--rate") == 0)
+                ret = parse_rate(val, &capture_rate);
+            else if (strcmp(arg, "--duration") == 0)
+                ret = parse_duration(val, &capture_duration_ns);
+            else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0)
+            {
+                capture_file = val;
+                ret = 0;
+            }
+            else if (strcmp(arg, "--format") == 0)
+            {
+                ret = 0;
+                if (strcmp(val, "sigrok") == 0)
+                    capture_sigrok = 1;
+                else if (strcmp(val, "vcd") != 0)
+                    ret = -1;
+            }
+            else
+            {
+                printf("Unknown argument \"%s\"\n", arg);
+                return 1;
+            }
+            if (ret)
+            {
+                printf("Invalid value \"%s\" for \"%s\"\n", val, arg);
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "dh") == 0)
             drive = DRIVE_HIGH;
         else if (strcmp(arg, "dl") == 0)
             drive = DRIVE_LOW;
@@ -654,6 +2135,22 @@ int main(int argc, char *argv[])
             pull = PULL_DOWN;
         else if (strcmp(arg, "pn") == 0)
             pull = PULL_NONE;
+        else if (strcmp(arg, "ds2") == 0)
+            pad_ctrl.strength = STRENGTH_2MA;
+        else if (strcmp(arg, "ds4") == 0)
+            pad_ctrl.strength = STRENGTH_4MA;
+        else if (strcmp(arg, "ds8") == 0)
+            pad_ctrl.strength = STRENGTH_8MA;
+        else if (strcmp(arg, "ds12") == 0)
+            pad_ctrl.strength = STRENGTH_12MA;
+        else if (strcmp(arg, "slow") == 0)
+            pad_ctrl.slew = SLEW_SLOW;
+        else if (strcmp(arg, "fast") == 0)
+            pad_ctrl.slew = SLEW_FAST;
+        else if (strcmp(arg, "schmitt") == 0)
+            pad_ctrl.schmitt = SCHMITT_ON;
+        else if (strcmp(arg, "noschmitt") == 0)
+            pad_ctrl.schmitt = SCHMITT_OFF;
         else
         {
             printf("Unknown argument \"%s\"\n", arg);
@@ -669,18 +2166,17 @@ int main(int argc, char *argv[])
     if (i < 0)
         memset(gpiomask, 0xff, sizeof(gpiomask));
 
-    if (!funcs)
-    {
-        ret = gpiolib_mmap();
-        if (ret)
-        {
-            if (ret == EACCES && geteuid())
-                printf("Must be root (or group 'gpio' on RPiOS)\n");
-            else
-                printf("Failed to mmap gpiolib - %s\n", strerror(ret));
-            return -1;
-        }
-    }
+    if (!funcs && map_gpios() != 0)
+        return -1;
+
+    if (set)
+        reset_gpio_sets();
+
+    if (save)
+        return do_save(save_file, gpiomask, start_pin, end_pin);
+
+    if (get)
+        snapshot_gpios(gpiomask, start_pin, end_pin);
 
     for (pin = start_pin; pin < end_pin + 1; pin++)
     {
@@ -689,8 +2185,8 @@ int main(int argc, char *argv[])
 
         if (get)
             do_gpio_get(pin);
-        if (set)
-            do_gpio_set(pin, fsparam, drive, pull);
+        if (set && do_gpio_set(pin, fsparam, drive, pull, &pad_ctrl) != 0)
+            set_failed = 1;
         if (level)
         {
             if (!first_pin)
@@ -698,8 +2194,12 @@ int main(int argc, char *argv[])
             do_gpio_level(pin);
             first_pin = 0;
         }
-        if (poll)
+        if (irqstat && do_gpio_irqstat(pin) != 0)
+            unsupported = 1;
+        if (poll || stats)
             do_gpio_poll_add(pin);
+        if (capture)
+            do_gpio_capture_add(pin);
         if (funcs)
             print_gpio_alts_info(pin);
     }
@@ -707,8 +2207,18 @@ int main(int argc, char *argv[])
     if (level)
         printf("\n");
 
+    if (unsupported)
+    {
+        printf("Edge status is only available on RP1 GPIOs\n");
+        return 1;
+    }
+
+    if (set)
+        apply_gpio_sets();
+
     if (set && echo)
     {
+        snapshot_gpios(gpiomask, start_pin, end_pin);
         for (pin = start_pin; pin < end_pin + 1; pin++)
         {
             if (!(gpiomask[pin / 32] & (1 << (pin % 32))))
@@ -718,8 +2228,298 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* The GPIOs that could be set have been, but report the rest */
+    if (set_failed)
+        return 1;
+
+    if (capture)
+        return do_gpio_capture();
+
+    if (stats)
+        return do_gpio_stats();
+
     if (poll)
+    {
+        /* Prefer kernel line events, falling back to sampling the levels */
+        if (do_gpio_poll_events() < 0)
+        {
+            if (verbose_mode)
+                printf("Line events unavailable - sampling levels\n");
             do_gpio_poll();
+        }
+    }
+
+    return 0;
+}
+
+static int do_wait(int argc, char *argv[])
+{
+    struct timespec ts;
+    unsigned long us;
+    char *end;
+
+    if (argc != 1)
+    {
+        printf("Usage: wait <microseconds>\n");
+        return 1;
+    }
+
+    us = strtoul(argv[0], &end, 10);
+    if (end == argv[0] || *end)
+    {
+        printf("Invalid wait time \"%s\"\n", argv[0]);
+        return 1;
+    }
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        continue;
 
     return 0;
 }
+
+static int do_script(const char *filename)
+{
+    FILE *fp = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+    char line[1024];
+    char *args[64];
+    unsigned line_num = 0;
+    int ret = 0;
+
+    if (!fp)
+    {
+        printf("Failed to open \"%s\"\n", filename);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        const char *name = (fp == stdin) ? "stdin" : filename;
+        uint64_t t0;
+        int num_args = 0;
+        char *p;
+        int c;
+
+        line_num++;
+
+        /* Never run what is left of a line as another command */
+        if (!strchr(line, '\n') && (c = getc(fp)) != EOF)
+        {
+            ungetc(c, fp);
+            printf("Line %u of \"%s\" is too long\n", line_num, name);
+            ret = 1;
+            break;
+        }
+
+        p = strchr(line, '#');
+        if (p)
+            *p = '\0';
+
+        for (p = strtok(line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n"))
+        {
+            if (num_args == (int)ARRAY_SIZE(args))
+                break;
+            args[num_args++] = p;
+        }
+        if (p)
+        {
+            printf("Too many arguments at line %u of \"%s\"\n", line_num, name);
+            ret = 1;
+            break;
+        }
+        if (!num_args)
+            continue;
+
+        t0 = time_now_ns();
+        if (strcmp(args[0], "wait") == 0)
+            ret = do_wait(num_args - 1, args + 1);
+        else
+            ret = do_command(num_args, args, 1);
+        if (verbose_mode)
+            printf("[%u: %" PRIu64 " us]\n", line_num, (time_now_ns() - t0) / 1000);
+
+        if (ret)
+        {
+            printf("Stopped at line %u of \"%s\"\n", line_num, name);
+            break;
+        }
+        fflush(stdout);
+    }
+
+    if (fp != stdin)
+        fclose(fp);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    /* arg parsing */
+
+    const char *script_file = NULL;
+    const char *serve_path = NULL;
+    const char *cache_file;
+    int list = 0;
+
+    argv++;
+    argc--;
+
+    while (argc && (argv[0][0] == '-'))
+    {
+        const char *arg = *(argv++);
+        argc--;
+
+        if (strcmp(arg, "-c") == 0)
+        {
+            if (!argc)
+            {
+                printf("* chip name expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            named_chip = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-d") == 0)
+        {
+            if (!argc)
+            {
+                printf("* DTB file or directory expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            dtb_file = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-e") == 0)
+        {
+            echo = 1;
+        }
+        else if (strcmp(arg, "-f") == 0)
+        {
+            if (!argc)
+            {
+                printf("* script file expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            script_file = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-") == 0)
+        {
+            script_file = arg;
+        }
+        else if (strcmp(arg, "--serve") == 0)
+        {
+            if (!argc)
+            {
+                printf("* socket path expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            serve_path = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "--sim") == 0)
+        {
+            if (!argc)
+            {
+                printf("* image directory expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            sim_dir = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-h") == 0)
+        {
+            usage();
+            return 0;
+        }
+        else if (strcmp(arg, "-l") == 0)
+        {
+            list = 1;
+            verbose_mode = 1;
+        }
+        else if (strcmp(arg, "-p") == 0)
+        {
+            pin_mode = 1;
+        }
+        else if (strcmp(arg, "-v") == 0)
+        {
+            verbose_mode = 1;
+        }
+        else
+        {
+            printf("Unknown option '%s' - try \"%s help\"\n",
+                   arg, program_name);
+            exit(1);
+        }
+    }
+
+    if (verbose_mode)
+        gpiolib_set_verbose(&verbose_callback);
+
+    cache_file = getenv("PINCTRL_CACHE");
+    if (cache_file && cache_file[0])
+        gpiolib_set_cache(cache_file);
+
+    if (dtb_file)
+        gpiolib_set_dtb(dtb_file);
+
+    if (sim_dir)
+        gpiolib_set_sim(sim_dir);
+
+    /* Remember what has been written, so that echoes and later script
+     * commands can report drives and pulls the hardware can't read back.
+     */
+    if (echo || script_file)
+        gpiolib_set_shadow(1);
+
+    if (named_chip)
+        ret = gpiolib_init_by_name(named_chip);
+    else
+        ret = gpiolib_init();
+
+    if (ret < 0)
+    {
+        if (dtb_file)
+            printf("Failed to load '%s' (a .dtb file needs libfdt)\n", dtb_file);
+        else
+            printf("Failed to initialise gpiolib - %d\n", ret);
+        return -1;
+    }
+
+    num_gpios = ret;
+    if (!num_gpios)
+    {
+        printf("No GPIO chips found\n");
+        return -1;
+    }
+
+    if (list)
+        return 0;
+
+    if (serve_path)
+    {
+        if (argc || script_file)
+        {
+            printf("Too many arguments\n");
+            return 1;
+        }
+        if (map_gpios() != 0)
+            return -1;
+        return gpio_serve(serve_path);
+    }
+
+    if (script_file)
+    {
+        if (argc)
+        {
+            printf("Too many arguments\n");
+            return 1;
+        }
+        return do_script(script_file);
+    }
+
+    return do_command(argc, argv, 0);
+}
@@ -4,19 +4,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
-#include "util.h"
+#if HAVE_LIBFDT
+#include <libfdt.h>
+#endif
 
-// We're actually going to cheat and cast the pointers, but define
-// a structure to keep the compiler happy.
+#include "util.h"
 
 struct dt_subnode_iter
 {
     DIR *dh;
+    int node;   /* FDT parent node offset */
+    int child;  /* FDT current child offset, or -1 before the first */
 };
 
 const char *dtpath;
 
+#if HAVE_LIBFDT
+static void *dt_blob;
+#endif
+
 static void *do_read_file(const char *fname, const char *mode, size_t *plen)
 {
     FILE *fp = fopen(fname, mode);
@@ -59,11 +67,95 @@ void dt_set_path(const char *path)
     dtpath = path;
 }
 
+#if HAVE_LIBFDT
+
+int dt_load_fdt(const char *fname)
+{
+    size_t len;
+    void *blob = read_file(fname, &len);
+
+    if (!blob)
+        return -1;
+    if (len < (size_t)FDT_V1_SIZE || fdt_check_header(blob) != 0 ||
+        fdt_totalsize(blob) > len)
+    {
+        free(blob);
+        return -1;
+    }
+
+    free(dt_blob);
+    dt_blob = blob;
+    return 0;
+}
+
+static int dt_fdt_offset(const char *node)
+{
+    char path[FILENAME_MAX];
+    char *p;
+
+    if (strlen(node) >= sizeof(path))
+        return -FDT_ERR_BADPATH;
+    strcpy(path, node);
+
+    // fdt_path_offset doesn't understand "..", so resolve those first
+    while ((p = strstr(path, "/..")) != NULL && (p[3] == '/' || p[3] == '\0'))
+    {
+        char *q;
+
+        *p = '\0';
+        q = strrchr(path, '/');
+        if (!q)
+            return -FDT_ERR_BADPATH;
+        if (q == path)
+            q++;
+        memmove(q, p + 3, strlen(p + 3) + 1);
+        if (!path[0])
+            strcpy(path, "/");
+    }
+
+    return fdt_path_offset(dt_blob, path);
+}
+
+#else
+
+int dt_load_fdt(const char *fname)
+{
+    (void)fname;
+    return -1;
+}
+
+#endif
+
 char *dt_read_prop(const char *node, const char *prop, size_t *plen)
 {
     char filename[FILENAME_MAX];
     size_t len;
 
+#if HAVE_LIBFDT
+    if (dt_blob)
+    {
+        const void *val;
+        char *buf;
+        int offset, val_len;
+
+        offset = dt_fdt_offset(node);
+        if (offset < 0)
+            return NULL;
+        val = fdt_getprop(dt_blob, offset, prop, &val_len);
+        if (!val)
+            return NULL;
+        // Return a copy - callers free it, and dt_read_cells swaps it in place
+        buf = malloc(val_len + 1);
+        if (!buf)
+            return NULL;
+        memcpy(buf, val, val_len);
+        buf[val_len] = '\0';
+        if (plen)
+            *plen = val_len;
+        return buf;
+    }
+#endif
+
     len = snprintf(filename, sizeof(filename), "%s%s/%s", dtpath, node, prop);
     if (len >= sizeof(filename))
     {
@@ -225,31 +317,81 @@ void dt_free(void *value)
 
 DT_SUBNODE_HANDLE dt_open_subnodes(const char *node)
 {
+    struct dt_subnode_iter *iter;
     char dirpath[FILENAME_MAX];
     size_t len;
 
+    iter = calloc(1, sizeof(*iter));
+    if (!iter)
+        return NULL;
+    iter->child = -1;
+
+#if HAVE_LIBFDT
+    if (dt_blob)
+    {
+        iter->node = dt_fdt_offset(node);
+        if (iter->node >= 0)
+            return iter;
+        free(iter);
+        return NULL;
+    }
+#endif
+
     len = snprintf(dirpath, sizeof(dirpath), "%s%s", dtpath, node);
     if (len >= sizeof(dirpath))
     {
         assert(0);
+        free(iter);
+        return NULL;
+    }
+    iter->dh = opendir(dirpath);
+    if (!iter->dh)
+    {
+        free(iter);
         return NULL;
     }
-    return (DT_SUBNODE_HANDLE)opendir(dirpath);
+    return iter;
 }
 
 const char *dt_next_subnode(DT_SUBNODE_HANDLE handle)
 {
-    DIR *dirh = (DIR *)handle;
     struct dirent *dent;
 
-    dent = readdir(dirh);
+#if HAVE_LIBFDT
+    if (!handle->dh)
+    {
+        if (handle->child < 0)
+            handle->child = fdt_first_subnode(dt_blob, handle->node);
+        else
+            handle->child = fdt_next_subnode(dt_blob, handle->child);
+        if (handle->child < 0)
+            return NULL;
+        return fdt_get_name(dt_blob, handle->child, NULL);
+    }
+#endif
 
-    return dent ? dent->d_name : NULL;
+    // Subnodes are directories - skip the properties and "." and ".."
+    while ((dent = readdir(handle->dh)) != NULL)
+    {
+        struct stat st;
+
+        if (dent->d_name[0] == '.')
+            continue;
+        if (dent->d_type == DT_DIR)
+            return dent->d_name;
+        // Not every filesystem reports the type
+        if (dent->d_type == DT_UNKNOWN &&
+            fstatat(dirfd(handle->dh), dent->d_name, &st, 0) == 0 &&
+            S_ISDIR(st.st_mode))
+            return dent->d_name;
+    }
+
+    return NULL;
 }
 
 void dt_close_subnodes(DT_SUBNODE_HANDLE handle)
 {
-    DIR *dirh = (DIR *)handle;
-
-    closedir(dirh);
+    if (handle->dh)
+        closedir(handle->dh);
+    free(handle);
 }
@@ -16,6 +16,8 @@ void *read_file(const char *fname, size_t *plen);
 
 void dt_set_path(const char *path);
 
+int dt_load_fdt(const char *fname);
+
 char *dt_read_prop(const char *node, const char *prop, size_t *len);
 
 uint32_t *dt_read_cells(const char *node, const char *prop, unsigned *num_cells);